@@ -0,0 +1,51 @@
+#pragma once
+//host (linux) stand-in for the ESP32 arduino core. only what MPPTLib uses
+#include <cstdint>
+#include <cstdio>
+#include <cmath>
+#include <cstdarg>
+#include <algorithm>
+#include <string>
+#include <stdexcept>
+#include "WString.h"
+#include "HardwareSerial.h"
+#include "freertos/FreeRTOS.h"
+
+using std::min;
+using std::max;
+#define constrain(amt,low,high) ((amt)<(low)?(low):((amt)>(high)?(high):(amt)))
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+#define LOW    0x0
+#define HIGH   0x1
+#define INPUT  0x01
+#define OUTPUT 0x02
+
+uint32_t millis();
+uint32_t micros();
+void delay(uint32_t ms);
+void delayMicroseconds(uint32_t us);
+void yield();
+
+uint16_t analogRead(uint8_t pin);
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t val);
+int digitalRead(uint8_t pin);
+int8_t digitalPinToAnalogChannel(uint8_t pin);
+uint32_t esp_random();
+
+class EspClass {
+public:
+  void restart();
+  uint32_t getSketchSize() { return 1024 * 1024; }
+  uint32_t getFreeHeap() { return 200 * 1024; }
+  uint64_t getEfuseMac(); //differs per host unit
+  uint32_t getCycleCount(); //host time at the esp32's clock rate
+  uint32_t getCpuFreqMHz() { return 240; }
+};
+extern EspClass ESP;
+
+inline bool heap_caps_check_integrity_all(bool print_errors) { return true; }
+#define RTC_NOINIT_ATTR //esp_attr.h: survives resets that don't cut power. host statics live as long as the process
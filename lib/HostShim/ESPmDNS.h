@@ -0,0 +1,9 @@
+#pragma once
+#include <cstdint>
+
+class MDNSResponder {
+public:
+  bool begin(const char *hostname) { return true; }
+  void addService(const char *service, const char *proto, uint16_t port) { }
+};
+extern MDNSResponder MDNS;
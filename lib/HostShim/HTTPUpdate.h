@@ -0,0 +1,14 @@
+#pragma once
+#include "Arduino.h"
+#include "WiFiClient.h"
+
+enum HTTPUpdateResult { HTTP_UPDATE_FAILED, HTTP_UPDATE_NO_UPDATES, HTTP_UPDATE_OK };
+typedef HTTPUpdateResult t_httpUpdate_return;
+
+class HTTPUpdate {
+public:
+  t_httpUpdate_return update(WiFiClient &client, const String &url, const String &version = "") { return HTTP_UPDATE_FAILED; }
+  int getLastError() { return -1; }
+  String getLastErrorString() { return "host build, no OTA"; }
+};
+extern HTTPUpdate httpUpdate;
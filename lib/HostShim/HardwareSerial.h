@@ -0,0 +1,28 @@
+#pragma once
+#include "Stream.h"
+
+#define SERIAL_8N1 0x800001c
+
+//a host serial port. bytes go to an attached (simulated) device, or stdout for the console
+class HardwareSerial : public Stream {
+  int num_;
+  Stream* device_ = nullptr;
+public:
+  explicit HardwareSerial(int num) : num_(num) { }
+  void begin(unsigned long baud, uint32_t config = SERIAL_8N1, int8_t rx = -1, int8_t tx = -1,
+      bool invert = false, unsigned long timeout_ms = 20000UL);
+  void end() { }
+  void attach(Stream* device) { device_ = device; }
+  Stream* device() const { return device_; }
+
+  int available() override { return device_? device_->available() : 0; }
+  int read() override { return device_? device_->read() : -1; }
+  int peek() override { return device_? device_->peek() : -1; }
+  size_t write(uint8_t c) override;
+  size_t write(const uint8_t *buf, size_t size) override;
+  using Print::write;
+};
+
+extern HardwareSerial Serial;
+extern HardwareSerial Serial1;
+extern HardwareSerial Serial2;
@@ -0,0 +1,9 @@
+#pragma once
+#include "WString.h"
+
+class IPAddress {
+  uint8_t b_[4];
+public:
+  IPAddress(uint8_t a = 0, uint8_t b = 0, uint8_t c = 0, uint8_t d = 0) : b_{a, b, c, d} { }
+  String toString() const { return String(b_[0]) + "." + String(b_[1]) + "." + String(b_[2]) + "." + String(b_[3]); }
+};
@@ -0,0 +1,48 @@
+#include "ModbusMaster.h"
+
+uint16_t modbusCrc16(const uint8_t *buf, size_t len) {
+  uint16_t crc = 0xFFFF;
+  while (len--) {
+    crc ^= *buf++;
+    for (int i = 0; i < 8; i++)
+      crc = (crc & 1)? (crc >> 1) ^ 0xA001 : crc >> 1;
+  }
+  return crc;
+}
+
+uint8_t ModbusMaster::readHoldingRegisters(uint16_t addr, uint16_t qty) { return transaction(0x03, addr, qty); }
+uint8_t ModbusMaster::writeSingleRegister(uint16_t addr, uint16_t value) { return transaction(0x06, addr, value); }
+
+uint8_t ModbusMaster::transaction(uint8_t func, uint16_t addr, uint16_t val) {
+  if (!serial_) return ku8MBResponseTimedOut;
+  uint8_t adu[256] = {slave_, func, (uint8_t)(addr >> 8), (uint8_t) addr, (uint8_t)(val >> 8), (uint8_t) val};
+  uint16_t crc = modbusCrc16(adu, 6);
+  adu[6] = crc & 0xFF;
+  adu[7] = crc >> 8;
+  while (serial_->read() >= 0) { } //flush
+  serial_->write(adu, 8);
+
+  size_t got = 0, want = 5; //shortest reply: exception
+  uint32_t start = millis();
+  while (got < want) {
+    int c = serial_->read();
+    if (c < 0) {
+      if ((millis() - start) > ku16MBResponseTimeout) return ku8MBResponseTimedOut;
+      yield();
+      continue;
+    }
+    adu[got++] = c;
+    if (got == 1 && adu[0] != slave_) return ku8MBInvalidSlaveID;
+    if (got == 2 && (adu[1] & 0x7F) != func) return ku8MBInvalidFunction;
+    if (got == 2 && (adu[1] & 0x80)) want = 5;
+    else if (got == 2 && func == 0x06) want = 8;
+    else if (got == 3 && func == 0x03 && !(adu[1] & 0x80)) want = 5 + adu[2];
+  }
+  crc = modbusCrc16(adu, got - 2);
+  if (adu[got - 2] != (crc & 0xFF) || adu[got - 1] != (crc >> 8)) return ku8MBInvalidCRC;
+  if (adu[1] & 0x80) return adu[2];
+  if (func == 0x03)
+    for (int i = 0; i < adu[2] / 2 && i < 64; i++)
+      response_[i] = (adu[3 + i * 2] << 8) | adu[4 + i * 2];
+  return ku8MBSuccess;
+}
@@ -0,0 +1,27 @@
+#pragma once
+#include "Arduino.h"
+
+uint16_t modbusCrc16(const uint8_t *buf, size_t len);
+
+//modbus RTU master, same surface as the 4-20ma/ModbusMaster library (subset)
+class ModbusMaster {
+public:
+  static const uint8_t ku8MBIllegalFunction     = 0x01;
+  static const uint8_t ku8MBIllegalDataAddress  = 0x02;
+  static const uint8_t ku8MBSuccess             = 0x00;
+  static const uint8_t ku8MBInvalidSlaveID      = 0xE0;
+  static const uint8_t ku8MBInvalidFunction     = 0xE1;
+  static const uint8_t ku8MBResponseTimedOut    = 0xE2;
+  static const uint8_t ku8MBInvalidCRC          = 0xE3;
+  static const uint16_t ku16MBResponseTimeout   = 2000; //ms
+
+  void begin(uint8_t slave, Stream &serial) { slave_ = slave; serial_ = &serial; }
+  uint8_t readHoldingRegisters(uint16_t addr, uint16_t qty);
+  uint8_t writeSingleRegister(uint16_t addr, uint16_t value);
+  uint16_t getResponseBuffer(uint8_t index) const { return index < 64? response_[index] : 0xFFFF; }
+private:
+  uint8_t transaction(uint8_t func, uint16_t addr, uint16_t val);
+  uint8_t slave_ = 1;
+  Stream* serial_ = nullptr;
+  uint16_t response_[64] = {0};
+};
@@ -0,0 +1,65 @@
+#include "Preferences.h"
+#include "hostShim.h"
+#include <map>
+#include <mutex>
+#include <vector>
+
+static std::mutex lock_;
+static std::map<int, std::map<String, std::map<String, std::vector<uint8_t>>>> nvs_; //unit, namespace, key
+static const size_t nvsEntries_ = 630; //~20KB nvs partition, 32B entries
+
+bool Preferences::begin(const char *name, bool readOnly) {
+  if (!name || strlen(name) > 15) return false;
+  ns_ = name;
+  unit_ = hostUnit();
+  readOnly_ = readOnly;
+  return open_ = true;
+}
+
+bool Preferences::clear() {
+  std::lock_guard<std::mutex> l(lock_);
+  if (!open_ || readOnly_) return false;
+  nvs_[unit_][ns_].clear();
+  return true;
+}
+bool Preferences::remove(const char *key) {
+  std::lock_guard<std::mutex> l(lock_);
+  if (!open_ || readOnly_) return false;
+  return nvs_[unit_][ns_].erase(key) > 0;
+}
+bool Preferences::isKey(const char *key) {
+  std::lock_guard<std::mutex> l(lock_);
+  return open_ && nvs_[unit_][ns_].count(key);
+}
+
+size_t Preferences::putBytes(const char *key, const void *value, size_t len) {
+  std::lock_guard<std::mutex> l(lock_);
+  if (!open_ || readOnly_ || !key || strlen(key) > 15 || !value || !len) return 0; //nvs key limits
+  auto p = (const uint8_t*) value;
+  nvs_[unit_][ns_][key].assign(p, p + len);
+  return len;
+}
+
+size_t Preferences::getBytes(const char *key, void *buf, size_t maxLen) {
+  std::lock_guard<std::mutex> l(lock_);
+  if (!open_ || !key) return 0;
+  auto it = nvs_[unit_][ns_].find(key);
+  if (it == nvs_[unit_][ns_].end() || it->second.size() > maxLen) return 0;
+  memcpy(buf, it->second.data(), it->second.size());
+  return it->second.size();
+}
+size_t Preferences::getBytesLength(const char *key) {
+  std::lock_guard<std::mutex> l(lock_);
+  if (!open_ || !key) return 0;
+  auto it = nvs_[unit_][ns_].find(key);
+  return it == nvs_[unit_][ns_].end()? 0 : it->second.size();
+}
+
+size_t Preferences::freeEntries() {
+  std::lock_guard<std::mutex> l(lock_);
+  size_t used = 0;
+  for (const auto &n : nvs_[unit_])
+    for (const auto &k : n.second)
+      used += 1 + (k.second.size() + 31) / 32;
+  return used < nvsEntries_? nvsEntries_ - used : 0;
+}
@@ -0,0 +1,21 @@
+#pragma once
+#include "Arduino.h"
+
+//host NVS, an in-memory map shared by all instances for the life of the process.
+//each host unit has its own, picked when opened
+class Preferences {
+  String ns_;
+  int unit_ = 0;
+  bool open_ = false, readOnly_ = false;
+public:
+  ~Preferences() { end(); }
+  bool begin(const char *name, bool readOnly = false);
+  void end() { open_ = false; }
+  bool clear();
+  bool remove(const char *key);
+  bool isKey(const char *key);
+  size_t putBytes(const char *key, const void *value, size_t len);
+  size_t getBytes(const char *key, void *buf, size_t maxLen);
+  size_t getBytesLength(const char *key);
+  size_t freeEntries();
+};
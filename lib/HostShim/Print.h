@@ -0,0 +1,25 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include "WString.h"
+
+class Print {
+public:
+  virtual ~Print() { }
+  virtual size_t write(uint8_t) = 0;
+  virtual size_t write(const uint8_t *buf, size_t size);
+  size_t write(const char *s) { return s? write((const uint8_t*) s, strlen(s)) : 0; }
+  virtual void flush() { }
+
+  size_t printf(const char *fmt, ...) __attribute__ ((format (printf, 2, 3)));
+  size_t print(const String &s) { return write((const uint8_t*) s.c_str(), s.length()); }
+  size_t print(const char *s) { return write(s); }
+  size_t print(char c) { return write((uint8_t) c); }
+  size_t print(int v) { return print(String(v)); }
+  size_t print(unsigned int v) { return print(String(v)); }
+  size_t print(long v) { return print(String(v)); }
+  size_t print(unsigned long v) { return print(String(v)); }
+  size_t print(double v, int digits = 2) { return print(String(v, digits)); }
+  size_t println() { return write("\r\n"); }
+  template<typename T> size_t println(const T &v) { size_t n = print(v); return n + println(); }
+};
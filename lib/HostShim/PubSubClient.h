@@ -0,0 +1,43 @@
+#pragma once
+#include "Arduino.h"
+#include "Client.h"
+#include "hostShim.h"
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+
+#define MQTT_CONNECTION_TIMEOUT   -4
+#define MQTT_CONNECTION_LOST      -3
+#define MQTT_CONNECT_FAILED       -2
+#define MQTT_DISCONNECTED         -1
+#define MQTT_CONNECTED             0
+
+#define MQTT_CALLBACK_SIGNATURE std::function<void(char*, uint8_t*, unsigned int)> callback
+
+//host stand-in. connects through the supplied Client, publishes go to the host mqtt sink.
+//hostMqttDeliver() queues messages for subscribers, the callback sees them from loop()
+class PubSubClient {
+  Client* client_ = nullptr;
+  MQTT_CALLBACK_SIGNATURE;
+  int state_ = MQTT_DISCONNECTED;
+  std::mutex lock_;
+  std::deque<std::pair<std::string, std::string>> inbox_;
+public:
+  PubSubClient() { }
+  ~PubSubClient();
+  PubSubClient& setClient(Client &c) { client_ = &c; return *this; }
+  PubSubClient& setServer(const char *domain, uint16_t port) { return *this; }
+  PubSubClient& setCallback(MQTT_CALLBACK_SIGNATURE) { this->callback = callback; return *this; }
+  bool setBufferSize(uint16_t size) { return true; }
+
+  bool connect(const char *id, const char *user, const char *pass); //a clean session, no subscriptions
+  void disconnect();
+  bool connected() { return state_ == MQTT_CONNECTED && client_ && client_->connected(); }
+  int state() { return state_; }
+  bool loop();
+  bool publish(const char *topic, const char *payload, bool retained = false) { return connected() && hostMqttPublish(topic, payload, retained); }
+  bool subscribe(const char *topic);
+  bool unsubscribe(const char *topic);
+  void deliver(const char *topic, const char *payload); //from the host broker, any thread
+};
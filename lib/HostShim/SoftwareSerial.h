@@ -0,0 +1,21 @@
+#pragma once
+#include "Arduino.h"
+#include "hostShim.h"
+
+#define SWSERIAL_8N1 0x1c
+
+//finds its device with attachSerialPin(rx, device)
+class SoftwareSerial : public Stream {
+  Stream* device_ = nullptr;
+public:
+  void begin(uint32_t baud, uint32_t config, int8_t rx, int8_t tx, bool invert) {
+    device_ = serialDeviceForPin(rx);
+    if (auto d = dynamic_cast<SerialDevice*>(device_)) d->begin(baud);
+  }
+  void end() { device_ = nullptr; }
+  int available() override { return device_? device_->available() : 0; }
+  int read() override { return device_? device_->read() : -1; }
+  int peek() override { return device_? device_->peek() : -1; }
+  size_t write(uint8_t c) override { return device_? device_->write(c) : 1; }
+  using Print::write;
+};
@@ -0,0 +1,51 @@
+#include "Stream.h"
+#include "Arduino.h"
+#include <cstdarg>
+#include <cstdio>
+
+size_t Print::write(const uint8_t *buf, size_t size) {
+  size_t n = 0;
+  while (size--) n += write(*buf++);
+  return n;
+}
+
+size_t Print::printf(const char *fmt, ...) {
+  char buf[256];
+  va_list args;
+  va_start(args, fmt);
+  int len = vsnprintf(buf, sizeof(buf), fmt, args);
+  va_end(args);
+  if (len < 0) return 0;
+  return write((const uint8_t*) buf, std::min<size_t>(len, sizeof(buf) - 1));
+}
+
+int Stream::timedRead() { //same shape as the arduino core: spin (and yield) until timeout
+  uint32_t start = millis();
+  do {
+    int c = read();
+    if (c >= 0) return c;
+    yield();
+  } while ((millis() - start) < timeout_);
+  return -1;
+}
+
+size_t Stream::readBytes(char *buf, size_t len) {
+  size_t n = 0;
+  for (int c; n < len && (c = timedRead()) >= 0; n++)
+    buf[n] = (char) c;
+  return n;
+}
+
+String Stream::readString() {
+  String ret;
+  for (int c; (c = timedRead()) >= 0; )
+    ret += (char) c;
+  return ret;
+}
+
+String Stream::readStringUntil(char terminator) {
+  String ret;
+  for (int c; (c = timedRead()) >= 0 && c != terminator; )
+    ret += (char) c;
+  return ret;
+}
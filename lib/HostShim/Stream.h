@@ -0,0 +1,19 @@
+#pragma once
+#include "Print.h"
+
+class Stream : public Print {
+protected:
+  unsigned long timeout_ = 1000;
+  int timedRead();
+public:
+  virtual int available() = 0;
+  virtual int read() = 0;
+  virtual int peek() = 0;
+
+  void setTimeout(unsigned long timeout) { timeout_ = timeout; }
+  unsigned long getTimeout() const { return timeout_; }
+  size_t readBytes(char *buf, size_t len);
+  size_t readBytes(uint8_t *buf, size_t len) { return readBytes((char*) buf, len); }
+  String readString();
+  String readStringUntil(char terminator);
+};
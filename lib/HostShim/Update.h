@@ -0,0 +1,17 @@
+#pragma once
+#include "Arduino.h"
+
+#define UPDATE_SIZE_UNKNOWN 0xFFFFFFFF
+
+//there is no flash to update on the host, every step fails
+class UpdateClass {
+public:
+  bool begin(size_t size = UPDATE_SIZE_UNKNOWN) { return false; }
+  size_t write(uint8_t *data, size_t len) { return 0; }
+  bool end(bool evenIfRemaining = false) { return false; }
+  void abort() { }
+  bool hasError() { return true; }
+  size_t progress() { return 0; }
+  void printError(Print &out) { out.println("host build, no OTA"); }
+};
+extern UpdateClass Update;
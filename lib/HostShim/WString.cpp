@@ -0,0 +1,81 @@
+#include "WString.h"
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+
+String::String(long v, unsigned char base) {
+  if (base == 10) { s_ = std::to_string(v); return; }
+  if (v < 0) { *this = String((unsigned long) -v, base); s_.insert(0, 1, '-'); }
+  else *this = String((unsigned long) v, base);
+}
+
+String::String(unsigned long v, unsigned char base) {
+  if (base < 2 || base > 36) base = 10;
+  do {
+    int d = v % base;
+    s_.insert(0, 1, (char)(d < 10? '0' + d : 'a' + d - 10));
+    v /= base;
+  } while (v);
+}
+
+String::String(double v, unsigned int decimals) {
+  char buf[64];
+  snprintf(buf, sizeof(buf), "%.*f", decimals, v);
+  s_ = buf;
+}
+
+bool String::equalsIgnoreCase(const String &s) const {
+  return s_.size() == s.s_.size() && std::equal(s_.begin(), s_.end(), s.s_.begin(),
+      [](char a, char b) { return tolower(a) == tolower(b); });
+}
+
+bool String::endsWith(const String &p) const {
+  return s_.length() >= p.s_.length() && s_.compare(s_.length() - p.s_.length(), p.s_.length(), p.s_) == 0;
+}
+
+int String::indexOf(char c, unsigned int from) const {
+  auto at = s_.find(c, from);
+  return at == std::string::npos? -1 : at;
+}
+int String::indexOf(const String &s, unsigned int from) const {
+  auto at = s_.find(s.s_, from);
+  return at == std::string::npos? -1 : at;
+}
+int String::lastIndexOf(char c) const {
+  auto at = s_.rfind(c);
+  return at == std::string::npos? -1 : at;
+}
+int String::lastIndexOf(const String &s) const {
+  auto at = s_.rfind(s.s_);
+  return at == std::string::npos? -1 : at;
+}
+
+String String::substring(unsigned int from, unsigned int to) const {
+  if (from > to) std::swap(from, to);
+  if (from >= s_.length()) return String();
+  return String(s_.substr(from, std::min<size_t>(to, s_.length()) - from));
+}
+
+void String::replace(char a, char b) { std::replace(s_.begin(), s_.end(), a, b); }
+void String::replace(const String &a, const String &b) {
+  if (a.s_.empty()) return;
+  for (size_t at = 0; (at = s_.find(a.s_, at)) != std::string::npos; at += b.s_.length())
+    s_.replace(at, a.s_.length(), b.s_);
+}
+void String::remove(unsigned int idx, unsigned int count) {
+  if (idx < s_.length()) s_.erase(idx, count);
+}
+void String::toLowerCase() { for (auto &c : s_) c = tolower(c); }
+void String::toUpperCase() { for (auto &c : s_) c = toupper(c); }
+void String::trim() {
+  auto isWs = [](char c) { return isspace((unsigned char) c); };
+  s_.erase(s_.begin(), std::find_if_not(s_.begin(), s_.end(), isWs));
+  s_.erase(std::find_if_not(s_.rbegin(), s_.rend(), isWs).base(), s_.end());
+}
+
+void String::toCharArray(char *buf, unsigned int size) const {
+  if (!buf || !size) return;
+  size_t n = std::min<size_t>(size - 1, s_.length());
+  memcpy(buf, s_.c_str(), n);
+  buf[n] = 0;
+}
@@ -0,0 +1,91 @@
+#pragma once
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <stdexcept>
+#include <functional>
+#include <memory>
+#include <utility>
+#include <type_traits>
+
+//host stand-in for the arduino String, backed by std::string
+class String {
+  std::string s_;
+  explicit String(std::string &&s) : s_(std::move(s)) { }
+public:
+  String(const char *c = "") : s_(c? c : "") { }
+  String(const char *c, unsigned int len) : s_(c, len) { } //may hold binary
+  String(const String &) = default;
+  String(String &&) = default;
+  String(char c) : s_(1, c) { }
+  String(unsigned char v, unsigned char base = 10) : String((unsigned long)v, base) { }
+  String(int v, unsigned char base = 10) : String((long)v, base) { }
+  String(unsigned int v, unsigned char base = 10) : String((unsigned long)v, base) { }
+  String(long v, unsigned char base = 10);
+  String(unsigned long v, unsigned char base = 10);
+  String(float v, unsigned int decimals = 2) : String((double)v, decimals) { }
+  String(double v, unsigned int decimals = 2);
+  String& operator=(const String &) = default;
+  String& operator=(String &&) = default;
+  String& operator=(const char *c) { s_ = c? c : ""; return *this; }
+
+  unsigned int length() const { return s_.length(); }
+  bool isEmpty() const { return s_.empty(); }
+  const char* c_str() const { return s_.c_str(); }
+  bool reserve(unsigned int n) { s_.reserve(n); return true; }
+
+  bool concat(const String &s) { s_ += s.s_; return true; }
+  bool concat(const char *c) { if (c) s_ += c; return true; }
+  bool concat(char c) { s_ += c; return true; }
+  bool concat(int v) { return concat(String(v)); }
+  bool concat(unsigned int v) { return concat(String(v)); }
+  bool concat(long v) { return concat(String(v)); }
+  bool concat(unsigned long v) { return concat(String(v)); }
+  bool concat(float v) { return concat(String(v)); }
+  bool concat(double v) { return concat(String(v)); }
+  template<typename T> String& operator+=(const T &v) { concat(v); return *this; }
+
+  char charAt(unsigned int i) const { return i < s_.length()? s_[i] : 0; }
+  void setCharAt(unsigned int i, char c) { if (i < s_.length()) s_[i] = c; }
+  char operator[](unsigned int i) const { return charAt(i); }
+  char& operator[](unsigned int i) { return s_[i]; }
+
+  int compareTo(const String &s) const { return s_.compare(s.s_); }
+  bool equals(const String &s) const { return s_ == s.s_; }
+  bool equalsIgnoreCase(const String &s) const;
+  bool operator==(const String &s) const { return s_ == s.s_; }
+  bool operator==(const char *c) const { return s_ == (c? c : ""); }
+  bool operator!=(const String &s) const { return s_ != s.s_; }
+  bool operator!=(const char *c) const { return !(*this == c); }
+  bool operator<(const String &s) const { return s_ < s.s_; }
+  bool startsWith(const String &p) const { return s_.compare(0, p.s_.length(), p.s_) == 0; }
+  bool endsWith(const String &p) const;
+
+  int indexOf(char c, unsigned int from = 0) const;
+  int indexOf(const String &s, unsigned int from = 0) const;
+  int lastIndexOf(char c) const;
+  int lastIndexOf(const String &s) const;
+  String substring(unsigned int from) const { return substring(from, length()); }
+  String substring(unsigned int from, unsigned int to) const;
+
+  void replace(char a, char b);
+  void replace(const String &a, const String &b);
+  void remove(unsigned int idx) { remove(idx, (unsigned int) -1); }
+  void remove(unsigned int idx, unsigned int count);
+  void toLowerCase();
+  void toUpperCase();
+  void trim();
+
+  long toInt() const { return atol(s_.c_str()); }
+  float toFloat() const { return atof(s_.c_str()); }
+  double toDouble() const { return atof(s_.c_str()); }
+  void toCharArray(char *buf, unsigned int size) const;
+
+  friend String operator+(const String &a, const String &b) { return String(a.s_ + b.s_); }
+  friend String operator+(const String &a, const char *b) { return String(a.s_ + (b? b : "")); }
+  friend String operator+(const char *a, const String &b) { return String((a? a : "") + b.s_); }
+  friend String operator+(const String &a, char b) { return String(a.s_ + b); }
+  template<typename T, typename = typename std::enable_if<std::is_arithmetic<T>::value && !std::is_same<T, char>::value>::type>
+  friend String operator+(const String &a, T b) { return a + String(b); }
+};
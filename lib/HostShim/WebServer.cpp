@@ -0,0 +1,98 @@
+#include "WebServer.h"
+#include <lwip/sockets.h>
+#include <algorithm>
+#include <map>
+#include <mutex>
+
+static std::mutex fdLock_;
+static std::map<int, std::weak_ptr<HostStream>> fds_; //like sockets, numbered once, gone with the stream
+int hostStreamFd(const std::shared_ptr<HostStream> &s) {
+  std::lock_guard<std::mutex> l(fdLock_);
+  static int next = 3;
+  if (s->fd < 0) fds_[s->fd = next++] = s;
+  return s->fd;
+}
+int lwip_send(int fd, const void *data, size_t size, int flags) {
+  std::shared_ptr<HostStream> s;
+  {
+    std::lock_guard<std::mutex> l(fdLock_);
+    auto it = fds_.find(fd);
+    if (it != fds_.end()) s = it->second.lock();
+  }
+  if (!s || !s->open) { errno = ENOTCONN; return -1; }
+  size_t n = std::min(size, s->window);
+  if (!n && size) { errno = (flags & MSG_DONTWAIT)? EAGAIN : ETIMEDOUT; return -1; }
+  s->data += String((const char*) data, n);
+  if (s->window != SIZE_MAX) s->window -= n;
+  return n;
+}
+
+void WebServer::on(const String &uri, HTTPMethod method, THandlerFunction fn, THandlerFunction upload) {
+  handlers_.push_back({uri, method, fn, upload});
+}
+
+String WebServer::arg(const String &name) const {
+  for (const auto &a : args_)
+    if (a.first == name) return a.second;
+  return String();
+}
+bool WebServer::hasArg(const String &name) const {
+  for (const auto &a : args_)
+    if (a.first == name) return true;
+  return false;
+}
+String WebServer::header(const String &name) const {
+  bool collected = false;
+  for (const auto &c : collect_) collected |= c.equalsIgnoreCase(name);
+  for (const auto &h : headers_)
+    if (collected && h.first.equalsIgnoreCase(name)) return h.second;
+  return String();
+}
+void WebServer::collectHeaders(const char *names[], size_t count) { collect_.assign(names, names + count); }
+WiFiClient WebServer::client() {
+  if (!resp_.stream) resp_.stream = std::make_shared<HostStream>();
+  return WiFiClient(resp_.stream);
+}
+String WebServer::Response::header(const String &name) const {
+  for (const auto &h : headers)
+    if (h.first.equalsIgnoreCase(name)) return h.second;
+  return String();
+}
+
+void WebServer::sendHeader(const String &name, const String &value, bool first) {
+  resp_.headers.push_back({name, value});
+}
+void WebServer::send(int code, const char *type, const String &content) {
+  resp_.code = code;
+  resp_.type = type? type : "";
+  resp_.body += content;
+}
+void WebServer::sendContent(const String &content) { resp_.body += content; }
+
+WebServer::Response WebServer::hostRequest(HTTPMethod method, const String &uri,
+    std::vector<std::pair<String, String>> args, std::vector<std::pair<String, String>> headers) {
+  uri_ = uri;
+  method_ = method;
+  args_ = args;
+  int q = uri.indexOf('?');
+  if (q >= 0) { //query string args, like the real server parses them
+    uri_ = uri.substring(0, q);
+    for (String rest = uri.substring(q + 1); rest.length(); ) {
+      int amp = rest.indexOf('&');
+      String kv = (amp < 0)? rest : rest.substring(0, amp);
+      rest = (amp < 0)? String() : rest.substring(amp + 1);
+      int eq = kv.indexOf('=');
+      args_.push_back({(eq < 0)? kv : kv.substring(0, eq), (eq < 0)? String() : kv.substring(eq + 1)});
+    }
+  }
+  headers_ = headers;
+  resp_ = Response();
+  contentLength_ = CONTENT_LENGTH_UNKNOWN;
+  for (const auto &h : handlers_)
+    if (h.uri == uri_ && (h.method == HTTP_ANY || h.method == method)) {
+      h.fn();
+      return resp_;
+    }
+  send(404, "text/plain", "Not found: " + uri_);
+  return resp_;
+}
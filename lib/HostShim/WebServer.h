@@ -0,0 +1,71 @@
+#pragma once
+#include "Arduino.h"
+#include "WiFiClient.h"
+#include <functional>
+#include <vector>
+
+enum HTTPMethod { HTTP_ANY, HTTP_GET, HTTP_HEAD, HTTP_POST, HTTP_PUT, HTTP_PATCH, HTTP_DELETE, HTTP_OPTIONS };
+enum HTTPUploadStatus { UPLOAD_FILE_START, UPLOAD_FILE_WRITE, UPLOAD_FILE_END, UPLOAD_FILE_ABORTED };
+
+#define HTTP_UPLOAD_BUFLEN 1436
+#define CONTENT_LENGTH_UNKNOWN ((size_t) -1)
+
+struct HTTPUpload {
+  HTTPUploadStatus status;
+  String filename, name, type;
+  size_t totalSize = 0, currentSize = 0;
+  uint8_t buf[HTTP_UPLOAD_BUFLEN];
+};
+
+//no sockets on the host. requests are injected with hostRequest(), which runs the
+//registered handler synchronously and captures what it sent
+class WebServer {
+public:
+  typedef std::function<void(void)> THandlerFunction;
+  struct Response {
+    int code = 0;
+    String type, body;
+    std::vector<std::pair<String, String>> headers;
+    std::shared_ptr<HostStream> stream; //if the handler kept client(), what it wrote, then and since
+    String header(const String &name) const;
+  };
+
+  WebServer(int port = 80) : port_(port) { }
+  void begin() { }
+  void handleClient() { }
+  void on(const String &uri, HTTPMethod method, THandlerFunction fn, THandlerFunction upload = nullptr);
+
+  String uri() const { return uri_; }
+  HTTPMethod method() const { return method_; }
+  String hostHeader() const { return "host"; }
+  int args() const { return args_.size(); }
+  String argName(int i) const { return i < args()? args_[i].first : String(); }
+  String arg(int i) const { return i < args()? args_[i].second : String(); }
+  String arg(const String &name) const;
+  bool hasArg(const String &name) const;
+  String header(const String &name) const; //only those named to collectHeaders()
+  void collectHeaders(const char *names[], size_t count);
+  WiFiClient client();
+  HTTPUpload& upload() { return upload_; }
+
+  void sendHeader(const String &name, const String &value, bool first = false);
+  void setContentLength(size_t len) { contentLength_ = len; }
+  void send(int code, const char *type = NULL, const String &content = String(""));
+  void send(int code, const String &type, const String &content) { send(code, type.c_str(), content); }
+  void sendContent(const String &content);
+  void sendContent(const char *content, size_t len) { sendContent(String(content, len)); }
+
+  Response hostRequest(HTTPMethod, const String &uri,
+      std::vector<std::pair<String, String>> args = {}, std::vector<std::pair<String, String>> headers = {});
+private:
+  struct Handler { String uri; HTTPMethod method; THandlerFunction fn, upload; };
+  int port_;
+  std::vector<Handler> handlers_;
+  String uri_;
+  HTTPMethod method_ = HTTP_GET;
+  std::vector<std::pair<String, String>> args_, headers_;
+  std::vector<String> collect_;
+  HTTPUpload upload_;
+  size_t contentLength_ = CONTENT_LENGTH_UNKNOWN;
+  Response resp_;
+};
@@ -0,0 +1,22 @@
+#pragma once
+#include "Arduino.h"
+#include "IPAddress.h"
+#include "WiFiClient.h"
+#include "hostShim.h"
+
+typedef enum {
+  WL_IDLE_STATUS = 0, WL_NO_SSID_AVAIL = 1, WL_CONNECTED = 3,
+  WL_CONNECT_FAILED = 4, WL_CONNECTION_LOST = 5, WL_DISCONNECTED = 6
+} wl_status_t;
+
+//host wifi is associated while setHostNetwork() says the network is up
+class WiFiClass {
+public:
+  wl_status_t begin(const char *ssid, const char *pass) { return hostNetworkUp()? WL_CONNECTED : WL_CONNECT_FAILED; }
+  bool setHostname(const char *) { return true; }
+  uint8_t waitForConnectResult() { return hostNetworkUp()? WL_CONNECTED : WL_CONNECT_FAILED; }
+  bool isConnected() { return hostNetworkUp(); }
+  bool disconnect(bool wifioff = false) { return true; }
+  IPAddress localIP() { return IPAddress(127, 0, 0, 1); }
+};
+extern WiFiClass WiFi;
@@ -0,0 +1,37 @@
+#pragma once
+#include "Client.h"
+#include <cstdint>
+#include <memory>
+
+//what the server side of a host connection has written, until the peer hangs up
+struct HostStream {
+  String data;
+  bool open = true;
+  int fd = -1;
+  size_t window = SIZE_MAX; //bytes a non-blocking send still gets in, a peer that stopped reading runs out
+};
+int hostStreamFd(const std::shared_ptr<HostStream> &); //registers it for lwip_send
+
+//no sockets on the host. a client that is connected while the host network is up,
+//or one WebServer::client() handed out, writing into its request's HostStream
+bool hostNetworkUp();
+class WiFiClient : public Client {
+  std::shared_ptr<HostStream> stream_;
+public:
+  WiFiClient() { }
+  WiFiClient(std::shared_ptr<HostStream> s) : stream_(s) { }
+  int connect(const char *host, uint16_t port) override { return hostNetworkUp(); }
+  uint8_t connected() override { return stream_? stream_->open : hostNetworkUp(); }
+  void stop() override { if (stream_) stream_->open = false; }
+  int fd() const { return stream_? hostStreamFd(stream_) : -1; }
+  int available() override { return 0; }
+  int read() override { return -1; }
+  int peek() override { return -1; }
+  size_t write(uint8_t c) override { return write(&c, 1); }
+  size_t write(const uint8_t *buf, size_t size) override {
+    if (!stream_ || !stream_->open) return 0;
+    stream_->data += String((const char*) buf, size);
+    return size;
+  }
+  using Print::write;
+};
@@ -0,0 +1,3 @@
+#pragma once
+#include <cstdint>
+inline int esp_task_wdt_init(uint32_t timeout_s, bool panic) { return 0; }
@@ -0,0 +1,40 @@
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "hostShim.h"
+#include <mutex>
+#include <thread>
+
+struct HostSemaphore { std::timed_mutex mutex; };
+
+SemaphoreHandle_t xSemaphoreCreateMutex() { return new HostSemaphore; }
+void vSemaphoreDelete(SemaphoreHandle_t s) { delete s; }
+BaseType_t xSemaphoreGive(SemaphoreHandle_t s) { s->mutex.unlock(); return pdTRUE; }
+BaseType_t xSemaphoreTake(SemaphoreHandle_t s, TickType_t ticks) {
+  if (!hostClock().realtime()) //single threaded, waiting could never help
+    return s->mutex.try_lock()? pdTRUE : pdFALSE;
+  return s->mutex.try_lock_for(std::chrono::milliseconds(ticks * portTICK_PERIOD_MS))? pdTRUE : pdFALSE;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char* name, uint32_t stack,
+    void* param, UBaseType_t priority, TaskHandle_t* handle, BaseType_t core) {
+  if (handle) *handle = nullptr;
+  if (!hostClock().realtime()) {
+    fprintf(stderr, "[host] task '%s' not started under a virtual clock\n", name);
+    return pdPASS;
+  }
+  int unit = hostUnit();
+  std::thread([=]{ setHostUnit(unit); fn(param); }).detach();
+  return pdPASS;
+}
+
+void vTaskDelay(TickType_t ticks) { delay(ticks * portTICK_PERIOD_MS); }
+void vTaskDelayUntil(TickType_t *prev, TickType_t inc) { //as freertos: no wait if it's already late, and no slip
+  TickType_t wake = *prev + inc, now = xTaskGetTickCount();
+  if ((int32_t)(wake - now) > 0) vTaskDelay(wake - now);
+  *prev = wake;
+}
+TickType_t xTaskGetTickCount() { return millis() / portTICK_PERIOD_MS; }
+TaskHandle_t xTaskGetCurrentTaskHandle() {
+  static thread_local char task;
+  return &task;
+}
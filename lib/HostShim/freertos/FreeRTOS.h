@@ -0,0 +1,28 @@
+#pragma once
+#include <cstdint>
+
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef void (*TaskFunction_t)(void*);
+typedef void* TaskHandle_t;
+
+#define pdFALSE 0
+#define pdTRUE  1
+#define pdPASS  pdTRUE
+#define portTICK_PERIOD_MS 1
+#define portMAX_DELAY (TickType_t) 0xffffffffUL
+#define tskNO_AFFINITY 0x7FFFFFFF
+
+//tasks run as std::threads under a realtime host clock. under a virtual clock
+//they are registered but not started (the driver owns time)
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char* name, uint32_t stack,
+    void* param, UBaseType_t priority, TaskHandle_t* handle, BaseType_t core);
+inline BaseType_t xTaskCreate(TaskFunction_t fn, const char* name, uint32_t stack,
+    void* param, UBaseType_t priority, TaskHandle_t* handle) {
+  return xTaskCreatePinnedToCore(fn, name, stack, param, priority, handle, tskNO_AFFINITY);
+}
+void vTaskDelay(TickType_t ticks);
+void vTaskDelayUntil(TickType_t *previousWake, TickType_t increment); //a fixed period, whatever ran in between
+TickType_t xTaskGetTickCount();
+TaskHandle_t xTaskGetCurrentTaskHandle(); //one per thread
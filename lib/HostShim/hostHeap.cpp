@@ -0,0 +1,38 @@
+//counts heap allocations for hostAllocs(). every form of new and delete is
+//replaced, all on malloc/free, so nothing pairs one of ours with a library
+//default. kept apart from the rest of the shim, with no containers in here,
+//so none of their inlined frees get checked against these
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+static std::atomic<uint64_t> allocs_(0);
+uint64_t hostAllocs() { return allocs_; }
+static void* hostAlloc(size_t n, size_t align = 0) {
+  allocs_++;
+  void *p = nullptr;
+  if (align > alignof(std::max_align_t)) return posix_memalign(&p, align, n? n : 1)? nullptr : p;
+  return malloc(n? n : 1);
+}
+void* operator new(size_t n) { if (void *p = hostAlloc(n)) return p; throw std::bad_alloc(); }
+void* operator new[](size_t n) { if (void *p = hostAlloc(n)) return p; throw std::bad_alloc(); }
+void* operator new(size_t n, const std::nothrow_t&) noexcept { return hostAlloc(n); }
+void* operator new[](size_t n, const std::nothrow_t&) noexcept { return hostAlloc(n); }
+void* operator new(size_t n, std::align_val_t a) { if (void *p = hostAlloc(n, (size_t) a)) return p; throw std::bad_alloc(); }
+void* operator new[](size_t n, std::align_val_t a) { if (void *p = hostAlloc(n, (size_t) a)) return p; throw std::bad_alloc(); }
+void* operator new(size_t n, std::align_val_t a, const std::nothrow_t&) noexcept { return hostAlloc(n, (size_t) a); }
+void* operator new[](size_t n, std::align_val_t a, const std::nothrow_t&) noexcept { return hostAlloc(n, (size_t) a); }
+void operator delete(void *p) noexcept { free(p); }
+void operator delete[](void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+void operator delete[](void *p, size_t) noexcept { free(p); }
+void operator delete(void *p, const std::nothrow_t&) noexcept { free(p); }
+void operator delete[](void *p, const std::nothrow_t&) noexcept { free(p); }
+void operator delete(void *p, std::align_val_t) noexcept { free(p); }
+void operator delete[](void *p, std::align_val_t) noexcept { free(p); }
+void operator delete(void *p, size_t, std::align_val_t) noexcept { free(p); }
+void operator delete[](void *p, size_t, std::align_val_t) noexcept { free(p); }
+void operator delete(void *p, std::align_val_t, const std::nothrow_t&) noexcept { free(p); }
+void operator delete[](void *p, std::align_val_t, const std::nothrow_t&) noexcept { free(p); }
@@ -0,0 +1,160 @@
+#include "hostShim.h"
+#include "rom/rtc.h"
+#include "esp_partition.h"
+#include <chrono>
+#include <cstdio>
+#include <map>
+#include <mutex>
+#include <new>
+#include <random>
+#include <thread>
+#include <vector>
+#include <cstring>
+
+// ----- clocks ----- //
+
+RealClock::RealClock() : start_(0) { start_ = micros64(); }
+uint64_t RealClock::micros64() {
+  using namespace std::chrono;
+  return duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count() - start_;
+}
+void RealClock::sleep(uint64_t us) { std::this_thread::sleep_for(std::chrono::microseconds(us)); }
+void RealClock::spin() { std::this_thread::yield(); }
+
+static RealClock realClock_;
+static HostClock* clock_ = &realClock_;
+void setHostClock(HostClock* c) { clock_ = c? c : &realClock_; }
+HostClock& hostClock() { return *clock_; }
+
+uint32_t millis() { return clock_->micros64() / 1000; }
+uint32_t micros() { return clock_->micros64(); }
+void delay(uint32_t ms) { clock_->sleep(ms * 1000ULL); }
+void delayMicroseconds(uint32_t us) { clock_->sleep(us); }
+void yield() { clock_->spin(); }
+
+// ----- units ----- //
+
+static thread_local int unit_ = 0;
+void setHostUnit(int u) { unit_ = u; }
+int hostUnit() { return unit_; }
+
+// ----- pins ----- //
+
+static AnalogSource analog_;
+static std::map<uint8_t, uint8_t> pins_;
+void setAnalogSource(AnalogSource s) { analog_ = s; }
+uint16_t analogRead(uint8_t pin) { return analog_? analog_(pin) : 0; }
+void pinMode(uint8_t pin, uint8_t mode) { }
+void digitalWrite(uint8_t pin, uint8_t val) { pins_[pin] = val? HIGH : LOW; }
+int digitalRead(uint8_t pin) { return pins_[pin]; }
+
+int8_t digitalPinToAnalogChannel(uint8_t pin) { //ESP32 mapping, ADC1 is 0-7, ADC2 10-19
+  switch (pin) {
+    case 36: return 0; case 37: return 1; case 38: return 2; case 39: return 3;
+    case 32: return 4; case 33: return 5; case 34: return 6; case 35: return 7;
+    case  4: return 10; case  0: return 11; case  2: return 12; case 15: return 13;
+    case 13: return 14; case 12: return 15; case 14: return 16; case 27: return 17;
+    case 25: return 18; case 26: return 19;
+  }
+  return -1;
+}
+
+// ----- serial ----- //
+
+static bool quiet_ = false;
+void setConsoleQuiet(bool q) { quiet_ = q; }
+
+HardwareSerial Serial(0);
+HardwareSerial Serial1(1);
+HardwareSerial Serial2(2);
+
+void HardwareSerial::begin(unsigned long baud, uint32_t, int8_t, int8_t, bool, unsigned long timeout_ms) {
+  if (auto d = dynamic_cast<SerialDevice*>(device_))
+    d->begin(baud);
+}
+size_t HardwareSerial::write(uint8_t c) { return write(&c, 1); }
+size_t HardwareSerial::write(const uint8_t *buf, size_t size) {
+  if (device_) return device_->write(buf, size);
+  if (num_ == 0 && !quiet_) fwrite(buf, 1, size, stdout);
+  return size;
+}
+
+static std::mutex pinLock_;
+static std::map<std::pair<int, int8_t>, Stream*> pinDevices_; //unit, rx pin
+void attachSerialPin(int8_t rx, Stream* device) {
+  std::lock_guard<std::mutex> l(pinLock_);
+  pinDevices_[{unit_, rx}] = device;
+}
+Stream* serialDeviceForPin(int8_t rx) {
+  std::lock_guard<std::mutex> l(pinLock_);
+  auto it = pinDevices_.find({unit_, rx});
+  return it == pinDevices_.end()? nullptr : it->second;
+}
+
+// ----- esp ----- //
+
+EspClass ESP;
+static std::function<void()> restart_;
+void setRestartHandler(std::function<void()> fn) { restart_ = fn; }
+void EspClass::restart() {
+  fflush(stdout);
+  if (restart_) restart_();
+  else exit(0);
+}
+
+uint32_t esp_random() {
+  static std::mutex lock;
+  static std::random_device rd;
+  std::lock_guard<std::mutex> l(lock);
+  return rd();
+}
+
+uint64_t EspClass::getEfuseMac() { return 0x2a9f1dcc5a24ULL + ((uint64_t) unit_ << 40); } //the byte the id is made from
+
+//under a virtual clock real time is added in, so cpu work shows up as well as delays
+uint32_t EspClass::getCycleCount() {
+  uint64_t us = clock_->micros64();
+  if (!clock_->realtime()) us += realClock_.micros64();
+  return us * getCpuFreqMHz();
+}
+
+static int resetReason_ = POWERON_RESET;
+void setResetReason(int r) { resetReason_ = r; }
+RESET_REASON rtc_get_reset_reason(int cpu) { return (RESET_REASON) resetReason_; }
+
+// ----- flash ----- //
+
+static esp_partition_t spiffs_ = {ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_DATA_SPIFFS, 0x290000, 128 * 1024, "spiffs", false};
+static std::mutex flashLock_;
+static std::map<int, std::vector<uint8_t>> flashes_; //by unit, erased until first touched
+static std::atomic<uint32_t> flashErases_(0);
+uint32_t hostFlashErases() { return flashErases_; }
+static std::vector<uint8_t>& flash() {
+  std::lock_guard<std::mutex> l(flashLock_);
+  auto &f = flashes_[unit_];
+  if (f.empty()) f.assign(spiffs_.size, 0xff);
+  return f;
+}
+
+const esp_partition_t* esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t sub, const char *label) {
+  if (type != spiffs_.type || (sub != ESP_PARTITION_SUBTYPE_ANY && sub != spiffs_.subtype)) return nullptr;
+  return (!label || !strcmp(label, spiffs_.label))? &spiffs_ : nullptr;
+}
+esp_err_t esp_partition_read(const esp_partition_t *p, size_t src, void *dst, size_t size) {
+  if (p != &spiffs_ || src + size > p->size) return ESP_ERR_INVALID_SIZE;
+  memcpy(dst, flash().data() + src, size);
+  return ESP_OK;
+}
+esp_err_t esp_partition_write(const esp_partition_t *p, size_t dst, const void *src, size_t size) {
+  if (p != &spiffs_ || dst + size > p->size) return ESP_ERR_INVALID_SIZE;
+  auto &f = flash();
+  for (size_t i = 0; i < size; i++) f[dst + i] &= ((const uint8_t*) src)[i]; //nor: 1 -> 0 only
+  return ESP_OK;
+}
+esp_err_t esp_partition_erase_range(const esp_partition_t *p, size_t offset, size_t size) {
+  if (p != &spiffs_ || offset + size > p->size) return ESP_ERR_INVALID_SIZE;
+  if (offset % SPI_FLASH_SEC_SIZE || size % SPI_FLASH_SEC_SIZE) return ESP_ERR_INVALID_ARG;
+  memset(flash().data() + offset, 0xff, size);
+  flashErases_ += size / SPI_FLASH_SEC_SIZE;
+  return ESP_OK;
+}
@@ -0,0 +1,73 @@
+#pragma once
+#include <Arduino.h>
+#include <atomic>
+#include <functional>
+
+//host-only hooks used to drive the shim layer from a simulator or benchmark.
+//none of this exists on the ESP32; firmware code must not include it.
+
+class HostClock {
+public:
+  virtual ~HostClock() { }
+  virtual uint64_t micros64() = 0;
+  virtual void sleep(uint64_t us) = 0; //delay(), blocking
+  virtual void spin() = 0; //yield(), busy-waits
+  virtual bool realtime() const = 0;
+};
+
+class RealClock : public HostClock {
+  uint64_t start_;
+public:
+  RealClock();
+  uint64_t micros64() override;
+  void sleep(uint64_t us) override;
+  void spin() override;
+  bool realtime() const override { return true; }
+};
+
+//time only moves when someone delays/yields or the driver calls advance(). lets
+//a whole day of Solar::loop() replay in seconds
+class VirtualClock : public HostClock {
+  std::atomic<uint64_t> now_;
+  uint32_t spinUs_;
+public:
+  VirtualClock(uint64_t startUs = 0, uint32_t spinUs = 20) : now_(startUs), spinUs_(spinUs) { }
+  uint64_t micros64() override { return now_; }
+  void sleep(uint64_t us) override { now_ += us; }
+  void spin() override { now_ += spinUs_; }
+  bool realtime() const override { return false; }
+  void advance(uint64_t us) { now_ += us; }
+};
+
+void setHostClock(HostClock*); //not owned, must outlive its use
+HostClock& hostClock();
+
+typedef std::function<uint16_t(uint8_t pin)> AnalogSource;
+void setAnalogSource(AnalogSource); //analogRead() results, 12 bit
+
+void attachSerialPin(int8_t rxPin, Stream* device); //SoftwareSerial devices, by rx pin
+Stream* serialDeviceForPin(int8_t rxPin);
+
+//several controllers in one process, see --fleet. each thread belongs to a unit, which
+//picks the nvs, flash, serial pins and mac it sees. tasks inherit their creator's, 0 to start
+void setHostUnit(int unit);
+int hostUnit();
+
+void setResetReason(int reason); //RESET_REASON reported by rtc_get_reset_reason
+void setRestartHandler(std::function<void()>); //ESP.restart(), defaults to exit(0)
+void setConsoleQuiet(bool); //drops Serial (console) output
+uint64_t hostAllocs(); //operator new calls so far, all threads
+
+//wifi and mqtt. down by default; when up, connects succeed and every mqtt publish goes to the sink
+typedef std::function<bool(const char *topic, const char *payload, bool retained)> MqttSink;
+void setHostNetwork(bool up, MqttSink sink = nullptr); //sink is kept when null
+bool hostNetworkUp();
+bool hostMqttPublish(const char *topic, const char *payload, bool retained);
+int hostMqttDeliver(const char *topic, const char *payload); //to the clients subscribed to topic, each gets it in its next loop(). how many
+uint32_t hostFlashErases(); //sectors, esp_partition
+
+//a simulated device hanging off a serial port. begin() sees the port baud rate
+class SerialDevice : public Stream {
+public:
+  virtual void begin(unsigned long baud) { }
+};
@@ -0,0 +1,8 @@
+#pragma once
+#include <cerrno>
+#include <cstddef>
+
+//just the non-blocking send the controller does on a WiFiClient's fd(). the host
+//has no sockets, it lands in the HostStream that fd belongs to
+#define MSG_DONTWAIT 0x08
+int lwip_send(int s, const void *dataptr, size_t size, int flags);
@@ -0,0 +1,79 @@
+#include "WiFi.h"
+#include "ESPmDNS.h"
+#include "Update.h"
+#include "HTTPUpdate.h"
+#include "PubSubClient.h"
+#include "hostShim.h"
+#include <map>
+
+WiFiClass WiFi;
+MDNSResponder MDNS;
+UpdateClass Update;
+HTTPUpdate httpUpdate;
+
+static std::atomic<bool> networkUp_(false);
+static MqttSink mqttSink_;
+void setHostNetwork(bool up, MqttSink sink) {
+  if (sink) mqttSink_ = sink;
+  networkUp_ = up;
+}
+bool hostNetworkUp() { return networkUp_; }
+bool hostMqttPublish(const char *topic, const char *payload, bool retained) {
+  return mqttSink_? mqttSink_(topic, payload, retained) : true;
+}
+
+static std::mutex subLock_;
+static std::multimap<std::string, PubSubClient*> subs_; //exact topics, no wildcards
+static void dropSubs(PubSubClient *c, const char *topic = nullptr) {
+  std::lock_guard<std::mutex> l(subLock_);
+  for (auto it = subs_.begin(); it != subs_.end(); )
+    if (it->second == c && (!topic || it->first == topic)) it = subs_.erase(it);
+    else it++;
+}
+int hostMqttDeliver(const char *topic, const char *payload) {
+  std::lock_guard<std::mutex> l(subLock_);
+  int ret = 0;
+  for (auto r = subs_.equal_range(topic); r.first != r.second; r.first++, ret++)
+    r.first->second->deliver(topic, payload);
+  return ret;
+}
+
+PubSubClient::~PubSubClient() { dropSubs(this); }
+bool PubSubClient::connect(const char *id, const char *user, const char *pass) {
+  dropSubs(this);
+  bool ok = client_ && client_->connected();
+  state_ = ok? MQTT_CONNECTED : MQTT_CONNECT_FAILED;
+  return ok;
+}
+void PubSubClient::disconnect() {
+  dropSubs(this);
+  state_ = MQTT_DISCONNECTED;
+}
+bool PubSubClient::subscribe(const char *topic) {
+  if (!connected()) return false;
+  dropSubs(this, topic);
+  std::lock_guard<std::mutex> l(subLock_);
+  subs_.emplace(topic, this);
+  return true;
+}
+bool PubSubClient::unsubscribe(const char *topic) {
+  if (!connected()) return false;
+  dropSubs(this, topic);
+  return true;
+}
+void PubSubClient::deliver(const char *topic, const char *payload) {
+  std::lock_guard<std::mutex> l(lock_);
+  inbox_.emplace_back(topic, payload);
+}
+bool PubSubClient::loop() { //one message per call, like reading one packet
+  if (!connected()) return false;
+  std::pair<std::string, std::string> m;
+  {
+    std::lock_guard<std::mutex> l(lock_);
+    if (inbox_.empty()) return true;
+    m = std::move(inbox_.front());
+    inbox_.pop_front();
+  }
+  if (callback) callback(&m.first[0], (uint8_t*) &m.second[0], m.second.length());
+  return true;
+}
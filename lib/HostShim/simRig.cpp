@@ -0,0 +1,247 @@
+#include "simRig.h"
+#include <cmath>
+#include <ModbusMaster.h>
+
+// ----- panel ----- //
+
+float PanelModel::vocAt(float irr) const {
+  if (irr < 0.001) return 0;
+  return max(0.0f, voc + a * logf(irr));
+}
+
+float PanelModel::current(float v, float irr) const {
+  float vo = vocAt(irr);
+  if (v >= vo) return 0;
+  return isc * irr * (1 - expf((v - vo) / a));
+}
+
+float PanelModel::mpp(float irr, float *vmp) const {
+  float lo = 0, hi = vocAt(irr);
+  for (int i = 0; i < 40; i++) { //ternary search, P(V) is unimodal
+    float m1 = lo + (hi - lo) / 3, m2 = hi - (hi - lo) / 3;
+    if (power(m1, irr) < power(m2, irr)) lo = m1;
+    else hi = m2;
+  }
+  if (vmp) *vmp = (lo + hi) / 2;
+  return power((lo + hi) / 2, irr);
+}
+
+float PanelModel::voltageForPower(float p, float irr) const {
+  float lo, hi = vocAt(irr);
+  mpp(irr, &lo);
+  for (int i = 0; i < 40; i++) { //P falls from vmp to voc
+    float m = (lo + hi) / 2;
+    if (power(m, irr) > p) lo = m;
+    else hi = m;
+  }
+  return lo;
+}
+
+// ----- rig ----- //
+
+float SimRig::hourOfDay() const {
+  return fmodf(startHour_ + hostClock().micros64() / 3.6e9, 24);
+}
+
+static float hashNoise(uint32_t k) { //0..1, stable per k
+  k ^= k >> 16; k *= 0x7feb352d; k ^= k >> 15; k *= 0x846ca68b; k ^= k >> 16;
+  return (k & 0xFFFF) / 65535.0;
+}
+
+float SimRig::irradiance() const {
+  float h = hourOfDay();
+  if (h <= 6 || h >= 18) return 0;
+  float sun = sinf(M_PI * (h - 6) / 12);
+  if (clouds_ > 0) { //value noise with ~3 minute features, sharp cloud edges
+    float t = hostClock().micros64() / 180e6;
+    uint32_t k = t;
+    float f = t - k, n = hashNoise(k) * (1 - f) + hashNoise(k + 1) * f;
+    sun *= 1 - clouds_ * constrain((n - 0.45) * 4, 0.0, 1.0);
+  }
+  return sun;
+}
+
+OpPoint SimRig::solve() const {
+  float irr = irradiance();
+  OpPoint r = {panel_.vocAt(irr), battVolt_, 0, panel_.mpp(irr), false, false};
+  if (!outEn_) return r;
+
+  float iwant = limitCurr_;
+  if (battVolt_ + iwant * battRes_ > limitVolt_) { //constant voltage
+    iwant = max(0.0f, (limitVolt_ - battVolt_) / battRes_);
+    r.cv = true;
+  }
+  r.vout = battVolt_ + iwant * battRes_;
+  float pneed = r.vout * iwant / efficiency_;
+  if (pneed <= r.pmax && r.vin > r.vout + dropout_) {
+    r.vin = panel_.voltageForPower(pneed, irr);
+    r.iout = iwant;
+  } else { //converter asks for more than the panel has: voltage collapses
+    r.vin = min(r.vout + dropout_, r.vin);
+    r.iout = panel_.power(r.vin, irr) * efficiency_ / r.vout;
+    r.vout = battVolt_ + r.iout * battRes_;
+    r.collapsed = true;
+    r.cv = false;
+  }
+  return r;
+}
+
+void SimRig::step() {
+  uint64_t now = hostClock().micros64();
+  OpPoint op = solve();
+  double hours = (now - lastStepUs_) / 3.6e9;
+  whOut_ += op.vout * op.iout * hours;
+  whAvail_ += op.pmax * efficiency_ * hours;
+  if (op.collapsed && !wasCollapsed_) collapses_++;
+  wasCollapsed_ = op.collapsed;
+  lastStepUs_ = now;
+}
+
+uint16_t SimRig::adcCounts() {
+  std::normal_distribution<float> noise(0, adcNoise_);
+  uint64_t now = hostClock().micros64();
+  if (!vinAt_ || now - vinAt_ >= 20000 || limitCurr_ != vinLimit_ || outEn_ != vinEn_) {
+    vin_ = solve().vin;
+    vinAt_ = now;
+    vinLimit_ = limitCurr_;
+    vinEn_ = outEn_;
+  }
+  float counts = vin_ / adcFullScale_ * 4096 + noise(rng_);
+  return constrain(counts, 0.0f, 4095.0f);
+}
+
+// ----- drok ----- //
+
+static int readyBytes(const std::deque<std::pair<uint64_t, uint8_t>> &out) {
+  uint64_t now = hostClock().micros64();
+  int n = 0;
+  for (const auto &b : out)
+    if (b.first <= now) n++;
+    else break;
+  return n;
+}
+
+
+int SimDrok::available() { return readyBytes(out_); }
+
+int SimDrok::peek() {
+  if (out_.empty() || out_.front().first > hostClock().micros64()) return -1;
+  return out_.front().second;
+}
+
+int SimDrok::read() {
+  int c = peek();
+  if (c >= 0) out_.pop_front();
+  return c;
+}
+
+size_t SimDrok::write(uint8_t c) {
+  rxDoneUs_ = max(hostClock().micros64(), rxDoneUs_) + byteUs(); //command bytes take time to arrive too
+  if (c == '\n') {
+    line_.trim();
+    if (line_.length()) handle(line_);
+    line_ = "";
+  } else line_ += (char) c;
+  return 1;
+}
+
+static String fourDigits(float v) {
+  char buf[8];
+  snprintf(buf, sizeof(buf), "%04d", constrain((int) lroundf(v * 100), 0, 9999));
+  return buf;
+}
+
+void SimDrok::handle(const String &cmd) {
+  commands_++;
+  OpPoint op = rig_.solve();
+  String hdr = cmd.substring(0, 3), body = cmd.substring(3);
+  if      (hdr == "aru") reply("#ru" + fourDigits(op.vout));
+  else if (hdr == "ari") reply("#ri" + fourDigits(op.iout));
+  else if (hdr == "aro") reply(String("#ro") + (rig_.outEn_? "1" : "0"));
+  else if (hdr == "arc") reply("#ra" + fourDigits(rig_.limitCurr_));
+  else if (hdr == "arv") reply("#rv" + fourDigits(rig_.limitVolt_));
+  else if (hdr == "awu") { rig_.step(); rig_.limitVolt_ = body.toInt() / 100.0; reply("#wuok"); }
+  else if (hdr == "awi") { rig_.step(); rig_.limitCurr_ = body.toInt() / 100.0; reply("#wiok"); }
+  else if (hdr == "awo") { rig_.step(); rig_.outEn_ = body.toInt() == 1; reply("#wook"); }
+  //unknown commands get no reply, like the real thing
+}
+
+void SimDrok::reply(const String &msg) {
+  uint64_t at = max<uint64_t>(rxDoneUs_ + latencyUs_, out_.empty()? 0 : out_.back().first); //one tx line, replies queue up
+  String s = msg + "\r\n";
+  for (unsigned i = 0; i < s.length(); i++)
+    out_.push_back({at += byteUs(), (uint8_t) s[i]});
+}
+
+// ----- dps ----- //
+
+int SimDps::available() { return readyBytes(out_); }
+int SimDps::peek() {
+  if (out_.empty() || out_.front().first > hostClock().micros64()) return -1;
+  return out_.front().second;
+}
+int SimDps::read() {
+  int c = peek();
+  if (c >= 0) out_.pop_front();
+  return c;
+}
+
+uint16_t SimDps::reg(uint16_t addr) const {
+  OpPoint op = rig_.solve();
+  switch (addr) {
+    case 0: return lroundf(rig_.limitVolt_ * 100);
+    case 1: return lroundf(rig_.limitCurr_ * 1000);
+    case 2: return lroundf(op.vout * 100);
+    case 3: return lroundf(op.iout * 1000);
+    case 4: return lroundf(op.vout * op.iout * 100);
+    case 5: return lroundf(op.vin * 100);
+    case 8: return rig_.outEn_ && !op.cv && !op.collapsed;
+    case 9: return rig_.outEn_;
+    case 0x0B: return 5005;
+    case 0x0C: return 14;
+  }
+  return 0;
+}
+
+size_t SimDps::write(uint8_t c) {
+  rxDoneUs_ = max(hostClock().micros64(), rxDoneUs_) + byteUs();
+  in_[inLen_++] = c;
+  if (inLen_ < 8) return 1;
+  uint16_t crc = modbusCrc16(in_, 6);
+  if (in_[0] != 1 || in_[6] != (crc & 0xFF) || in_[7] != (crc >> 8)) { //resync a byte at a time
+    memmove(in_, in_ + 1, --inLen_);
+    return 1;
+  }
+  inLen_ = 0;
+  frames_++;
+  uint16_t addr = (in_[2] << 8) | in_[3], val = (in_[4] << 8) | in_[5];
+  uint8_t out[256] = {1, in_[1]};
+  if (in_[1] == 0x03 && val <= 64) {
+    out[2] = val * 2;
+    for (int i = 0; i < val; i++) {
+      uint16_t r = reg(addr + i);
+      out[3 + i * 2] = r >> 8;
+      out[4 + i * 2] = r & 0xFF;
+    }
+    reply(out, 3 + val * 2);
+  } else if (in_[1] == 0x06) {
+    rig_.step();
+    if      (addr == 0) rig_.limitVolt_ = val / 100.0;
+    else if (addr == 1) rig_.limitCurr_ = val / 1000.0;
+    else if (addr == 9) rig_.outEn_ = val;
+    reply(in_, 6); //echo
+  } else {
+    out[1] |= 0x80;
+    out[2] = ModbusMaster::ku8MBIllegalFunction;
+    reply(out, 3);
+  }
+  return 1;
+}
+
+void SimDps::reply(const uint8_t *buf, size_t len) {
+  uint16_t crc = modbusCrc16(buf, len);
+  uint64_t at = max<uint64_t>(rxDoneUs_ + latencyUs_, out_.empty()? 0 : out_.back().first);
+  for (size_t i = 0; i < len; i++) out_.push_back({at += byteUs(), buf[i]});
+  out_.push_back({at += byteUs(), (uint8_t)(crc & 0xFF)});
+  out_.push_back({at += byteUs(), (uint8_t)(crc >> 8)});
+}
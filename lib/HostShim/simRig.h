@@ -0,0 +1,98 @@
+#pragma once
+#include "hostShim.h"
+#include <deque>
+#include <random>
+
+//single-diode-ish PV panel: I(V) = Isc*irr*(1 - exp((V - Voc)/a))
+struct PanelModel {
+  float isc = 9.5, voc = 44.0, a = 2.4; //at 1000W/m2
+  float vocAt(float irr) const;
+  float current(float v, float irr) const;
+  float power(float v, float irr) const { return v * current(v, irr); }
+  float mpp(float irr, float *vmp = nullptr) const;
+  float voltageForPower(float p, float irr) const; //high-voltage side solution
+};
+
+struct OpPoint {
+  float vin, vout, iout, pmax;
+  bool collapsed, cv;
+};
+
+//panel -> buck converter -> battery. the converter state (limits, enable) is
+//driven by whichever simulated PSU device talks to the firmware
+class SimRig {
+public:
+  PanelModel panel_;
+  float battVolt_ = 25.6, battRes_ = 0.02, efficiency_ = 0.95, dropout_ = 0.8;
+  float limitVolt_ = 28.8, limitCurr_ = 1.0;
+  bool outEn_ = false;
+  float startHour_ = 0, clouds_ = 0; //clouds 0..1, how deep passing clouds shade
+  float adcFullScale_ = 116.5, adcNoise_ = 6.0; //volts at 4095, noise in counts
+  double whOut_ = 0, whAvail_ = 0;
+  uint32_t collapses_ = 0;
+
+  SimRig(uint32_t seed = 1) : rng_(seed) { }
+  float hourOfDay() const;
+  float irradiance() const;
+  OpPoint solve() const;
+  void step(); //integrates energy since the last call, counts collapse events
+  uint16_t adcCounts(); //noisy 12 bit reading of the panel voltage
+private:
+  std::mt19937 rng_;
+  uint64_t lastStepUs_ = 0;
+  bool wasCollapsed_ = false;
+  uint64_t vinAt_ = 0; //adcCounts() only re-solves every 20ms, or when the converter changes
+  float vin_ = 0, vinLimit_ = 0;
+  bool vinEn_ = false;
+};
+
+//a Drok buck converter's ttl serial port. replies appear byte by byte at the
+//configured baud rate plus a fixed processing latency, measured on hostClock()
+class SimDrok : public SerialDevice {
+public:
+  SimDrok(SimRig &rig) : rig_(rig) { }
+  void begin(unsigned long baud) override { baud_ = baud; }
+  int available() override;
+  int read() override;
+  int peek() override;
+  size_t write(uint8_t c) override;
+  using Print::write;
+
+  uint32_t latencyUs_ = 4000;
+  uint32_t commands_ = 0;
+private:
+  void handle(const String &cmd);
+  void reply(const String &msg);
+  uint32_t byteUs() const { return 10 * 1000000UL / baud_; } //8N1
+  SimRig &rig_;
+  unsigned long baud_ = 4800;
+  uint64_t rxDoneUs_ = 0;
+  String line_;
+  std::deque<std::pair<uint64_t, uint8_t>> out_;
+};
+
+//a DPS5005's modbus RTU port (slave 1). registers 0-9 + model/version, writes
+//to the voltage limit, current limit and enable registers drive the rig
+class SimDps : public SerialDevice {
+public:
+  SimDps(SimRig &rig) : rig_(rig) { }
+  void begin(unsigned long baud) override { baud_ = baud; }
+  int available() override;
+  int read() override;
+  int peek() override;
+  size_t write(uint8_t c) override;
+  using Print::write;
+
+  uint32_t latencyUs_ = 3000;
+  uint32_t frames_ = 0;
+private:
+  uint16_t reg(uint16_t addr) const;
+  void reply(const uint8_t *buf, size_t len);
+  uint32_t byteUs() const { return 10 * 1000000UL / baud_; }
+  SimRig &rig_;
+  unsigned long baud_ = 19200;
+  uint64_t rxDoneUs_ = 0;
+  uint8_t in_[8];
+  size_t inLen_ = 0;
+  std::deque<std::pair<uint64_t, uint8_t>> out_;
+};
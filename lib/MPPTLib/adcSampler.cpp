@@ -0,0 +1,56 @@
+#include "adcSampler.h"
+#include <Arduino.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+void AdcSampler::runTask(void *c) {
+  AdcSampler *a = (AdcSampler*) c;
+  a->tasked_ = true;
+  TickType_t last = xTaskGetTickCount();
+  while (true) {
+    a->tick();
+    TickType_t ticks = a->periodMs_ / portTICK_PERIOD_MS;
+    vTaskDelayUntil(&last, ticks? ticks : 1); //from the last wake, so oversampling and preemption don't stretch the period
+  }
+}
+
+void AdcSampler::begin(bool task) {
+  tick();
+  begun_ = true;
+  nextTick_ = millis() + periodMs_;
+  if (task) xTaskCreate(runTask, "adc", 2048, this, 2, NULL);
+}
+
+void AdcSampler::tick() {
+  if (!source_ || busy_.exchange(true)) return; //the task and a catching-up poll() never overlap
+  uint32_t sum = 0;
+  for (int i = 0; i < oversample_; i++) sum += source_();
+  float s = sum / (float) max((int) oversample_, 1);
+  ring_[head_++ % ADC_RING_SIZE] = s;
+
+  float win[ADC_MEDIAN];
+  int n = min(head_, (uint32_t) ADC_MEDIAN);
+  for (int i = 0; i < n; i++) { //insertion sort the newest n
+    float v = ring_[(head_ - 1 - i) % ADC_RING_SIZE];
+    int j = i;
+    for (; j > 0 && win[j - 1] > v; j--) win[j] = win[j - 1];
+    win[j] = v;
+  }
+  float f = filt_.load(std::memory_order_relaxed);
+  f = (head_ == 1)? win[0] : f + alpha_ * (win[n / 2] - f);
+  filt_.store(f, std::memory_order_relaxed);
+  float dev = noise_.load(std::memory_order_relaxed);
+  noise_.store(dev + 0.01 * (fabs(s - f) - dev), std::memory_order_relaxed);
+  samples_.fetch_add(1, std::memory_order_relaxed);
+  busy_ = false;
+}
+
+void AdcSampler::poll() {
+  if (!begun_ || tasked_) return;
+  uint32_t now = millis();
+  for (int n = 0; (int32_t)(now - nextTick_) >= 0; n++) {
+    if (n >= ADC_RING_SIZE) { nextTick_ = now + periodMs_; break; } //way behind, resync rather than burst
+    tick();
+    nextTick_ += periodMs_;
+  }
+}
@@ -0,0 +1,40 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <functional>
+
+#define ADC_RING_SIZE 32 //oversampled samples kept, power of two
+#define ADC_MEDIAN 5     //window of the spike-rejecting median, odd
+
+typedef std::function<uint16_t()> SampleSource; //one raw conversion, 12 bit
+
+//background input pin acquisition: every period it averages a few raw reads
+//(oversampling), rings the result, takes the median of the newest few and runs
+//that through a single pole IIR. the control loop reads the filter output in O(1).
+//on the ESP32 a task drives tick(), where tasks don't run (host virtual clock)
+//poll() from loop() catches up instead
+class AdcSampler {
+  SampleSource source_;
+  float ring_[ADC_RING_SIZE];
+  uint32_t head_ = 0; //producer only
+  std::atomic<float> filt_, noise_;
+  std::atomic<uint32_t> samples_;
+  uint32_t nextTick_ = 0;
+  bool begun_ = false;
+  std::atomic<bool> tasked_, busy_; //a task is ticking, a tick is running
+  static void runTask(void *c);
+public:
+  uint16_t periodMs_ = 2;
+  uint8_t oversample_ = 4;
+  float alpha_ = 0.1; //iir weight of each new median, ~20ms time constant at 2ms
+
+  AdcSampler(SampleSource s = nullptr) : filt_(0), noise_(0), samples_(0), tasked_(false), busy_(false) { source_ = s; }
+  void setSource(SampleSource s) { source_ = s; }
+  void begin(bool task = true); //first tick happens right here, so latest() is valid after
+  bool begun() const { return begun_; }
+  void tick(); //one oversampled sample through the filters
+  void poll(); //runs any ticks that are due, when no task is doing it
+  float latest() const { return filt_.load(std::memory_order_relaxed); } //filtered counts
+  float noise() const { return noise_.load(std::memory_order_relaxed); } //mean |raw - filtered| counts
+  uint32_t samples() const { return samples_.load(std::memory_order_relaxed); }
+};
@@ -0,0 +1,199 @@
+#include "history.h"
+#include <new>
+
+void BitWriter::put(uint32_t v, int n) {
+  for (int i = n - 1; i >= 0; i--, pos_++) {
+    uint8_t mask = 0x80 >> (pos_ & 7);
+    if ((v >> i) & 1) buf_[pos_ >> 3] |= mask;
+    else buf_[pos_ >> 3] &= ~mask;
+  }
+}
+
+uint32_t BitReader::get(int n) {
+  uint32_t v = 0;
+  for (int i = 0; i < n; i++, pos_++)
+    v = (v << 1) | ((pos_ < len_)? (buf_[pos_ >> 3] >> (7 - (pos_ & 7))) & 1 : 0);
+  return v;
+}
+
+static int32_t signExtend(uint32_t v, int n) { return (int32_t)(v << (32 - n)) >> (32 - n); }
+
+void GorillaState::encode(BitWriter &w, const HistSample &s) {
+  uint32_t delta = s.ms - t;
+  int32_t dod = delta - this->delta;
+  bool same = (dod == 0 && s.state == state);
+  for (int f = 0; same && f < HIST_FIELDS; f++) same = !memcmp(&s.v[f], &bits[f], 4);
+  w.put(!same, 1); //steady state, nights: the whole sample is one bit
+  if (same) { t = s.ms; return; }
+  if (dod == 0) w.put(0, 1);
+  else if (dod >= -16 && dod < 16) { w.put(0b10, 2); w.put(dod, 5); } //measurement jitter
+  else if (dod >= -256 && dod < 256) { w.put(0b110, 3); w.put(dod, 9); }
+  else if (dod >= -2048 && dod < 2048) { w.put(0b1110, 4); w.put(dod, 12); }
+  else { w.put(0b1111, 4); w.put(dod, 32); }
+  t = s.ms;
+  this->delta = delta;
+  for (int f = 0; f < HIST_FIELDS; f++) {
+    uint32_t b;
+    memcpy(&b, &s.v[f], 4);
+    uint32_t x = b ^ bits[f];
+    bits[f] = b;
+    if (!x) { w.put(0, 1); continue; }
+    int l = min(__builtin_clz(x), 31), tr = __builtin_ctz(x);
+    if ((lead[f] || trail[f]) && l >= lead[f] && tr >= trail[f]) { //fits the last window
+      w.put(0b10, 2);
+      w.put(x >> trail[f], 32 - lead[f] - trail[f]);
+    } else {
+      w.put(0b11, 2);
+      w.put(l, 5);
+      w.put(31 - l - tr, 5); //length - 1
+      w.put(x >> tr, 32 - l - tr);
+      lead[f] = l;
+      trail[f] = tr;
+    }
+  }
+  if (s.state == state) w.put(0, 1);
+  else { w.put(1, 1); w.put(s.state, 3); }
+  state = s.state;
+}
+
+bool GorillaState::decode(BitReader &r, HistSample *s) {
+  int32_t dod = 0;
+  bool changed = r.get(1);
+  if (changed && r.get(1)) {
+    if (!r.get(1)) dod = signExtend(r.get(5), 5);
+    else if (!r.get(1)) dod = signExtend(r.get(9), 9);
+    else if (!r.get(1)) dod = signExtend(r.get(12), 12);
+    else dod = r.get(32);
+  }
+  delta += dod;
+  t += delta;
+  s->ms = t;
+  for (int f = 0; f < HIST_FIELDS; f++) {
+    if (changed && r.get(1)) {
+      if (r.get(1)) {
+        lead[f] = r.get(5);
+        trail[f] = 32 - lead[f] - (r.get(5) + 1);
+      }
+      bits[f] ^= r.get(32 - lead[f] - trail[f]) << trail[f];
+    }
+    memcpy(&s->v[f], &bits[f], 4);
+  }
+  if (changed && r.get(1)) state = r.get(3);
+  s->state = state;
+  return !r.overrun();
+}
+
+History::History() : lock_(xSemaphoreCreateMutex()) { }
+
+bool History::startBlock(uint32_t ms) {
+  if (!blocks_) {
+    blocks_.reset(new (std::nothrow) Block[HIST_BLOCKS]);
+    if (!blocks_) return false;
+  } else head_ = (head_ + 1) % HIST_BLOCKS;
+  used_ = min(used_ + 1, HIST_BLOCKS);
+  Block &b = blocks_[head_];
+  b.t0 = ms;
+  b.count = b.bits = 0;
+  enc_ = GorillaState();
+  enc_.t = ms;
+  return true;
+}
+
+void History::record(uint32_t ms, float inVolt, float outVolt, float outCurr, uint8_t state) {
+  if (xSemaphoreTake(lock_, 0) != pdTRUE) { skipped_++; return; }
+  HistSample s = {ms, {inVolt, outVolt, outCurr}, state};
+  for (int f = 0; f < HIST_FIELDS; f++)
+    s.v[f] = roundf(s.v[f] / quantum_[f]) * quantum_[f];
+  bool ok = blocks_ && (HIST_BLOCK_BYTES * 8 - blocks_[head_].bits) >= HIST_SAMPLE_BITS;
+  if (ok || startBlock(ms)) {
+    Block &b = blocks_[head_];
+    BitWriter w(b.data, HIST_BLOCK_BYTES * 8, b.bits);
+    enc_.encode(w, s);
+    b.bits = w.pos();
+    b.count++;
+    samples_++;
+  }
+  xSemaphoreGive(lock_);
+}
+
+//"FTH1" u32:now u16:blocks, then per block u32:t0 u16:count u16:bits and the bytes. little endian
+void History::dump(uint32_t from, uint32_t to, const ChunkFn &out) const {
+  uint8_t buf[8 + HIST_BLOCK_BYTES];
+  uint16_t n = 0;
+  int first = 0;
+  if (xSemaphoreTake(lock_, 100) != pdTRUE) return;
+  int oldest = (head_ - used_ + 1 + HIST_BLOCKS) % HIST_BLOCKS, used = used_; //records may move head_ on while sending
+  for (int i = 0; i < used; i++) { //oldest first
+    int at = (oldest + i) % HIST_BLOCKS;
+    bool last = (i == used - 1);
+    if ((int32_t)(blocks_[at].t0 - to) > 0) break;
+    if (!last && (int32_t)(blocks_[(at + 1) % HIST_BLOCKS].t0 - from) <= 0) { first = i + 1; continue; }
+    n++;
+  }
+  xSemaphoreGive(lock_);
+  uint32_t now = millis();
+  memcpy(buf, "FTH1", 4);
+  memcpy(buf + 4, &now, 4);
+  memcpy(buf + 8, &n, 2);
+  out((const char*) buf, 10);
+  for (int i = first; i < first + n; i++) {
+    if (xSemaphoreTake(lock_, 100) != pdTRUE) return;
+    const Block &b = blocks_[(oldest + i) % HIST_BLOCKS]; //copied whole, sent outside the lock
+    size_t bytes = (b.bits + 7) / 8;
+    memcpy(buf, &b.t0, 4);
+    memcpy(buf + 4, &b.count, 2);
+    memcpy(buf + 6, &b.bits, 2);
+    memcpy(buf + 8, b.data, bytes);
+    xSemaphoreGive(lock_); //so the control loop never waits on the network
+    out((const char*) buf, 8 + bytes);
+  }
+}
+
+int History::decode(const uint8_t *buf, size_t len, const std::function<void(const HistSample&)> &fn, uint32_t *now) {
+  if (len < 10 || memcmp(buf, "FTH1", 4)) return -1;
+  uint16_t n;
+  if (now) memcpy(now, buf + 4, 4);
+  memcpy(&n, buf + 8, 2);
+  size_t at = 10;
+  int ret = 0;
+  for (int i = 0; i < n; i++) {
+    uint32_t t0;
+    uint16_t count, bits;
+    if (at + 8 > len) return -1;
+    memcpy(&t0, buf + at, 4);
+    memcpy(&count, buf + at + 4, 2);
+    memcpy(&bits, buf + at + 6, 2);
+    at += 8;
+    if (at + (bits + 7) / 8 > len) return -1;
+    BitReader r(buf + at, bits);
+    GorillaState st;
+    st.t = t0;
+    for (int s = 0; s < count; s++) {
+      HistSample hs;
+      if (!st.decode(r, &hs)) return -1;
+      fn(hs);
+      ret++;
+    }
+    at += (bits + 7) / 8;
+  }
+  return ret;
+}
+
+uint32_t History::bytes() const {
+  uint32_t ret = 0;
+  for (int i = 0; blocks_ && i < used_; i++)
+    ret += (blocks_[(head_ - i + HIST_BLOCKS) % HIST_BLOCKS].bits + 7) / 8;
+  return ret;
+}
+
+uint32_t History::held() const {
+  uint32_t ret = 0;
+  for (int i = 0; blocks_ && i < used_; i++)
+    ret += blocks_[(head_ - i + HIST_BLOCKS) % HIST_BLOCKS].count;
+  return ret;
+}
+
+uint32_t History::spanMs() const {
+  if (!blocks_ || !used_) return 0;
+  return enc_.t - blocks_[(head_ - used_ + 1 + HIST_BLOCKS) % HIST_BLOCKS].t0;
+}
@@ -0,0 +1,69 @@
+#pragma once
+#include "publishable.h"
+#include <memory>
+
+#define HIST_BLOCKS 32        //ring of independently decodable blocks, the oldest is dropped whole
+#define HIST_BLOCK_BYTES 1024
+#define HIST_FIELDS 3         //involt, outvolt, outcurr (the first channel's panel, the whole bank's current). power is derived when decoding
+#define HIST_SAMPLE_BITS 177  //worst case encoded sample, a block seals when less is left
+
+struct HistSample {
+  uint32_t ms;
+  float v[HIST_FIELDS];
+  uint8_t state;
+  float power() const { return v[1] * v[2]; }
+};
+
+class BitWriter {
+  uint8_t *buf_;
+  uint32_t cap_, pos_; //bits
+public:
+  BitWriter(uint8_t *buf, uint32_t capBits, uint32_t pos = 0) : buf_(buf), cap_(capBits), pos_(pos) { }
+  void put(uint32_t v, int n); //low n bits of v, msb first
+  uint32_t pos() const { return pos_; }
+  uint32_t left() const { return cap_ - pos_; }
+};
+
+class BitReader {
+  const uint8_t *buf_;
+  uint32_t len_, pos_;
+public:
+  BitReader(const uint8_t *buf, uint32_t lenBits) : buf_(buf), len_(lenBits), pos_(0) { }
+  uint32_t get(int n);
+  bool overrun() const { return pos_ > len_; }
+};
+
+//delta-of-delta timestamps and xor'd floats (gorilla, facebook 2015) per field,
+//kept separately so the writer and the host-side reader share it
+struct GorillaState {
+  uint32_t t = 0, delta = 0;
+  uint32_t bits[HIST_FIELDS] = {0};
+  uint8_t lead[HIST_FIELDS] = {0}, trail[HIST_FIELDS] = {0}; //current xor window, 0/0 is none yet
+  uint8_t state = 0;
+  void encode(BitWriter &, const HistSample &);
+  bool decode(BitReader &, HistSample *);
+};
+
+//in-ram time series of what the controller saw, sampled every measurement. values
+//are rounded to their quantum first so a steady reading repeats exactly and costs
+//one bit. the control task records, the web server dumps; records that would
+//wait on a dump in progress are skipped rather than stall the loop
+class History {
+  struct Block { uint32_t t0; uint16_t count, bits; uint8_t data[HIST_BLOCK_BYTES]; };
+  std::unique_ptr<Block[]> blocks_; //allocated on the first record
+  int head_ = 0, used_ = 0; //head_ is being written
+  GorillaState enc_;
+  SemaphoreHandle_t lock_;
+  bool startBlock(uint32_t ms);
+public:
+  float quantum_[HIST_FIELDS] = {1 / 16.0, 1 / 128.0, 1 / 128.0}; //powers of two keep the mantissas, and so the xors, short
+  uint32_t samples_ = 0, skipped_ = 0;
+
+  History();
+  void record(uint32_t ms, float inVolt, float outVolt, float outCurr, uint8_t state);
+  void dump(uint32_t from, uint32_t to, const ChunkFn &) const; //blocks overlapping [from, to], see decode()
+  static int decode(const uint8_t *buf, size_t len, const std::function<void(const HistSample&)> &, uint32_t *now = nullptr); //samples, -1 if malformed
+  uint32_t bytes() const; //encoded, in the ring
+  uint32_t held() const; //samples in the ring
+  uint32_t spanMs() const; //oldest to newest
+};
@@ -0,0 +1,47 @@
+#include "latency.h"
+#include "utils.h"
+
+int LatencyHist::bucketOf(uint32_t us) {
+  if (us < LAT_SUB) return us;
+  int msb = 31 - __builtin_clz(us);
+  int b = (msb - 1) * LAT_SUB + ((us >> (msb - 2)) & (LAT_SUB - 1));
+  return (b < LAT_BUCKETS)? b : LAT_BUCKETS - 1;
+}
+
+uint32_t LatencyHist::upperEdge(int b) {
+  if (b < LAT_SUB) return b;
+  int octave = b / LAT_SUB;
+  return ((uint32_t)(LAT_SUB + b % LAT_SUB + 1) << (octave - 1)) - 1;
+}
+
+void LatencyHist::record(uint32_t us) {
+  if (resetting_.exchange(false)) {
+    memset(buckets_, 0, sizeof(buckets_));
+    count_ = max_ = 0;
+    sum_ = 0;
+  }
+  buckets_[bucketOf(us)]++;
+  count_++;
+  sum_ += us;
+  if (us > max_) max_ = us;
+}
+
+uint32_t LatencyHist::percentile(float p) const {
+  if (!count_ || resetting_) return 0;
+  uint32_t want = ceil(p * count_), seen = 0;
+  for (int b = 0; b < LAT_BUCKETS; b++)
+    if ((seen += buckets_[b]) >= want)
+      return min(upperEdge(b), max_);
+  return max_;
+}
+
+void LatencyHist::print(StrBuf &s) const {
+  if (resetting_) s.add("%s: reset", name_);
+  else s.add("%s: %u runs, p50 %uus p99 %uus max %uus", name_, count_, percentile(0.5), percentile(0.99), max_);
+}
+
+void LatencyHist::json(StrBuf &s) const {
+  bool r = resetting_;
+  s.add("\"%s\":{\"n\":%u,\"mean\":%0.0f,\"p50\":%u,\"p99\":%u,\"max\":%u}", name_, r? 0 : count_,
+      r? 0 : mean(), percentile(0.5), percentile(0.99), r? 0 : max_);
+}
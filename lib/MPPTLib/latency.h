@@ -0,0 +1,41 @@
+#pragma once
+#include <Arduino.h>
+#include <atomic>
+
+class StrBuf;
+
+#define LAT_SUB 4      //buckets per power of two, ~19% resolution
+#define LAT_BUCKETS 96 //tops out around 33s
+
+//fixed bucket latency histogram in microseconds, log-linear like hdr-histogram so
+//1us and 1s are both resolved to a few percent in 400 bytes. one task records and
+//anyone can read; reset() only raises a flag that the recording task acts on, so
+//counts are never written from two tasks
+class LatencyHist {
+  uint32_t buckets_[LAT_BUCKETS];
+  uint32_t count_ = 0, max_ = 0;
+  uint64_t sum_ = 0;
+  std::atomic<bool> resetting_;
+public:
+  const char *name_ = "";
+  LatencyHist() : resetting_(true) { }
+  void record(uint32_t us);
+  void reset() { resetting_ = true; }
+  uint32_t count() const { return count_; }
+  uint32_t max() const { return max_; }
+  double mean() const { return count_? sum_ / (double) count_ : 0; }
+  uint32_t percentile(float p) const; //us, upper edge of the bucket it lands in
+  void print(StrBuf &) const;
+  void json(StrBuf &) const;
+  static int bucketOf(uint32_t us);
+  static uint32_t upperEdge(int bucket);
+};
+
+//times a scope with the cpu cycle counter, into h
+class StageTimer {
+  LatencyHist &h_;
+  uint32_t start_;
+public:
+  StageTimer(LatencyHist &h) : h_(h), start_(ESP.getCycleCount()) { }
+  ~StageTimer() { h_.record((ESP.getCycleCount() - start_) / ESP.getCpuFreqMHz()); } //wraps every ~18s at 240MHz
+};
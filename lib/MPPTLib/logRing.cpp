@@ -0,0 +1,53 @@
+#include "logRing.h"
+#include <cstdio>
+#include <cstring>
+
+void LogRecord::add(const char *s) {
+  if (argc >= LOG_MAX_ARGS || textLen >= LOG_TEXT_SIZE) { overran = true; return; }
+  size_t l = strlen(s? s : ""), room = LOG_TEXT_SIZE - textLen - 1;
+  if (l > room) { l = room; overran = true; }
+  memcpy(text + textLen, s, l);
+  text[textLen + l] = 0;
+  types[argc] = 's';
+  args[argc++].s = textLen;
+  textLen += l + 1;
+}
+
+//re-runs the format one conversion at a time against the stored args. length
+//modifiers are dropped since everything was widened to int64 / double / char*
+size_t LogRecord::format(char *buf, size_t len) const {
+  if (!len) return 0;
+  size_t at = 0;
+  int arg = 0;
+  for (const char *f = fmt; *f && at + 1 < len; f++) {
+    if (*f != '%') { buf[at++] = *f; continue; }
+    if (f[1] == '%') { buf[at++] = '%'; f++; continue; }
+    char spec[16] = "%";
+    size_t n = 1;
+    while (f[1] && strchr("-+ #0123456789.", f[1]) && n < 10) spec[n++] = *++f;
+    while (f[1] && strchr("hlLqjzt", f[1])) f++;
+    char conv = *++f;
+    if (!conv) break;
+    int w = 0;
+    if (arg >= argc) w = snprintf(buf + at, len - at, "?");
+    else {
+      char t = types[arg];
+      auto a = args[arg++];
+      if (strchr("fFeEgGaA", conv)) {
+        spec[n++] = conv;
+        w = snprintf(buf + at, len - at, spec, (t == 'd')? a.d : (double) a.i);
+      } else if (strchr("diouxXc", conv)) {
+        if (conv != 'c') { spec[n++] = 'l'; spec[n++] = 'l'; }
+        spec[n++] = conv;
+        long long v = (t == 'd')? (long long) a.d : a.i;
+        w = (conv == 'c')? snprintf(buf + at, len - at, spec, (int) v) : snprintf(buf + at, len - at, spec, v);
+      } else {
+        spec[n++] = 's';
+        w = snprintf(buf + at, len - at, spec, (t == 's')? text + a.s : "?");
+      }
+    }
+    if (w > 0) at += ((size_t) w < len - at)? w : len - at - 1;
+  }
+  buf[at] = 0;
+  return at;
+}
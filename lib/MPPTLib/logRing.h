@@ -0,0 +1,61 @@
+#pragma once
+#include <WString.h>
+#include <atomic>
+#include <type_traits>
+
+#define LOG_MAX_ARGS 6
+#define LOG_TEXT_SIZE 128 //string args are copied in here
+#define LOG_RING_SIZE 32  //records, power of two
+#define LOG_LINE_SIZE 200 //formatted
+
+//one log call, not yet formatted. fmt doubles as the format id so it must be a literal
+struct LogRecord {
+  uint32_t ms;
+  const char *fmt;
+  uint8_t argc, textLen;
+  bool overran; //args didn't fit
+  char types[LOG_MAX_ARGS]; //i(nteger) d(ouble) s(tring)
+  union { int64_t i; double d; uint16_t s; } args[LOG_MAX_ARGS];
+  char text[LOG_TEXT_SIZE];
+
+  template<typename T>
+  typename std::enable_if<std::is_arithmetic<T>::value || std::is_enum<T>::value>::type add(T v) {
+    if (argc >= LOG_MAX_ARGS) { overran = true; return; }
+    if (std::is_floating_point<T>::value) { types[argc] = 'd'; args[argc++].d = v; }
+    else { types[argc] = 'i'; args[argc++].i = (int64_t) v; }
+  }
+  void add(const char *s);
+  void add(const String &s) { add(s.c_str()); }
+  size_t format(char *buf, size_t len) const; //printf, on the consumer side
+};
+
+//lock-free single producer / single consumer. the producer only fills a slot and
+//bumps head_, all the formatting and printing cost lands on whoever pops
+class LogRing {
+  LogRecord recs_[LOG_RING_SIZE];
+  std::atomic<uint32_t> head_, tail_; //free running, written by producer / consumer
+public:
+  uint32_t drops_ = 0, overruns_ = 0; //producer side, ring full / args truncated
+  LogRing() : head_(0), tail_(0) { }
+
+  template<typename... A>
+  bool push(uint32_t ms, const char *fmt, const A&... args) {
+    uint32_t h = head_.load(std::memory_order_relaxed);
+    if (h - tail_.load(std::memory_order_acquire) >= LOG_RING_SIZE) { drops_++; return false; }
+    LogRecord &r = recs_[h % LOG_RING_SIZE];
+    r.ms = ms;
+    r.fmt = fmt;
+    r.argc = r.textLen = 0;
+    r.overran = false;
+    int expand[] = {0, (r.add(args), 0)...};
+    (void) expand;
+    if (r.overran) overruns_++;
+    head_.store(h + 1, std::memory_order_release);
+    return true;
+  }
+  LogRecord const* peek() const { //oldest, or null
+    uint32_t t = tail_.load(std::memory_order_relaxed);
+    return (t == head_.load(std::memory_order_acquire))? nullptr : &recs_[t % LOG_RING_SIZE];
+  }
+  void pop() { tail_.store(tail_.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+};
@@ -1,11 +1,17 @@
 #include "powerSupplies.h"
 #include <stdexcept>
+#include <algorithm>
 #include <SoftwareSerial.h>
 #include <ModbusMaster.h> // ModbusMaster
+#include "publishable.h" //logFmt
 #include "utils.h"
 
+//hardware uarts for the supplies, channel 1's Serial2 first. one supply each:
+//a second begin() would re-pin the port out from under the first
+static HardwareSerial* const hwPorts[] = {&Serial2, &Serial1};
+
 //form: rxpin,txpin[sw]:baud
-Stream* makeStream(String s, int baud) {
+Stream* makeStream(String s, int baud, const std::vector<Stream*> &taken) {
   auto sp1 = split(s, ":");
   if (sp1.second.length()) //specify baud rate
     baud = sp1.second.toInt();
@@ -21,20 +27,26 @@ Stream* makeStream(String s, int baud) {
       return ret;
     }
   }
-  Serial2.begin(baud, SERIAL_8N1, rx, tx, false, 1000);
-  return &Serial2;
+  for (auto hw : hwPorts) {
+    if (std::find(taken.begin(), taken.end(), hw) != taken.end()) continue;
+    if (hw != &Serial2 && (rx < 0 || tx < 0)) //Serial1's default pins are the spi flash
+      throw std::runtime_error("Serial2 is in use, Serial1 needs its rx,tx pins given");
+    hw->begin(baud, SERIAL_8N1, rx, tx, false, 1000);
+    return hw;
+  }
+  throw std::runtime_error("both hardware uarts are in use, put this psu on software serial (rx,txsw)");
 }
 
-PowerSupply* PowerSupply::make(String type) {
+PowerSupply* PowerSupply::make(String type, const std::vector<Stream*> &taken) {
   type.toLowerCase();
   auto sp1 = split(type, ":");
   PowerSupply* ret = NULL;
   String typeUp = type;
   typeUp.toUpperCase();
   if (typeUp.startsWith("DP")) {
-    ret = new DPS(makeStream(sp1.second, 19200));
+    ret = new DPS(makeStream(sp1.second, 19200, taken));
   } else if (typeUp.startsWith("DROK")) {
-    ret = new Drok(makeStream(sp1.second, 4800));
+    ret = new Drok(makeStream(sp1.second, 4800, taken));
   } else { //default
     ret = NULL;
   }
@@ -63,8 +75,13 @@ PowerSupply::~PowerSupply() {
 }
 
 String PowerSupply::toString() const {
-  return str("PSU-out[%0.2fV %0.2fA]-lim[%0.2fV %0.2fA]", outVolt_, outCurr_, limitVolt_, limitCurr_)
-    + (outEn_? " ENABLED":"") + (isCV()? " CV":"") + (isCC()? " CC":"") + (isCollapsed()? " CLPS":"");
+  FixedStr<96> s;
+  print(s);
+  return s.c_str();
+}
+void PowerSupply::print(StrBuf &s) const {
+  s.add("PSU-out[%0.2fV %0.2fA]-lim[%0.2fV %0.2fA]", outVolt_, outCurr_, limitVolt_, limitCurr_);
+  s.add("%s%s%s%s", outEn_? " ENABLED":"", isCV()? " CV":"", isCC()? " CC":"", isCollapsed()? " CLPS":"");
 }
 
 bool PowerSupply::isCV() const { return ((limitVolt_ - outVolt_) / limitVolt_) < 0.004; }
@@ -82,45 +99,71 @@ void PowerSupply::doTotals() {
 // -------- Drok -------- //
 // ---------------------- //
 
-Drok::Drok(Stream* port) : PowerSupply() { port_ = port; }
-Drok::~Drok() { }
+Drok::Drok(Stream* port) : PowerSupply(), lock_(xSemaphoreCreateMutex()) { port_ = port; }
+Drok::~Drok() { vSemaphoreDelete(lock_); }
 
 bool Drok::begin() {
   flush();
-  return doUpdate();
+  doUpdate();
+  await();
+  return lastUpdateOk_;
 }
 
 bool Drok::doUpdate() {
-  bool res = readVoltage() &&
-         readCurrent() &&
-         readOutputEnabled();
-  if (res && !limitVolt_) {
-    handleReply(cmdReply("arc")); //read current limit
-    handleReply(cmdReply("arv")); //read voltage limit
-    log(getType() + str(" finished begin, got %0.3fV %0.3fA limits\n", limitVolt_, limitCurr_));
+  if (!updateLeft_) {
+    bool limits = !limitVolt_;
+    bool pipe = pipeline_ && (updates_++ % 16); //every 16th runs sequentially, keeps the speedup measured
+    updateOk_ = true;
+    updateLeft_ = limits? 5 : 3;
+    updateStart_ = busy()? 0 : millis(); //only time updates that start on an idle line
+    auto check = [this, limits, pipe](bool ok, const char *r) {
+      updateOk_ &= ok && handleReply(r);
+      if (--updateLeft_) return;
+      lastUpdateOk_ = updateOk_;
+      if (updateOk_ && updateStart_) {
+        float &ms = updateMs_[pipe], took = millis() - updateStart_;
+        ms = ms? ms + 0.2 * (took - ms) : took;
+      }
+      if (limits && updateOk_)
+        logFmt("%s finished begin, got %0.3fV %0.3fA limits\n", getType(), limitVolt_, limitCurr_);
+    };
+    for (auto cmd : {"aru", "ari", "arc", "arv", "aro"}) { //arc, arv read the current & voltage limits
+      if (!limits && (cmd[2] == 'c' || cmd[2] == 'v')) continue;
+      if (!queue(cmd, check, pipe)) {
+        updateOk_ = false;
+        --updateLeft_;
+      }
+    }
+    if (!updateLeft_) lastUpdateOk_ = false;
   }
-  return res;
+  return lastUpdateOk_;
+}
+
+String Drok::getStats() const {
+  String ret = str("full update %0.1fms sequential", updateMs_[0]);
+  if (updateMs_[1] > 0)
+    ret += str(", %0.1fms pipelined (%0.2fx)", updateMs_[1], updateMs_[0] / updateMs_[1]);
+  return ret + str(", %d txns %d timeouts", txns_, timeouts_);
 }
 
-bool Drok::readVoltage() { return handleReply(cmdReply("aru")); }
-bool Drok::readCurrent() { return handleReply(cmdReply("ari")); }
-bool Drok::readOutputEnabled() { return handleReply(cmdReply("aro")); }
+bool Drok::readVoltage() { return queue("aru", [this](bool ok, const char *r) { if (ok) handleReply(r); }, pipeline_); }
+bool Drok::readCurrent() { return queue("ari", [this](bool ok, const char *r) { if (ok) handleReply(r); }, pipeline_); }
+bool Drok::readOutputEnabled() { return queue("aro", [this](bool ok, const char *r) { if (ok) handleReply(r); }, pipeline_); }
 
 template<typename T>void setCheck(T &save, float in, float max) { if (in < max) save = in; }
 
-bool Drok::handleReply(const String &msg) {
-  if (!msg.length()) return false;
-  String hdr = msg.substring(0, 3);
-  String body = msg.substring(3);
-  if      (hdr == "#ro") setCheck(outEn_, (body.toInt() == 1), 2);
-  else if (hdr == "#ru") setCheck(outVolt_, body.toFloat() / 100.0, 80);
-  else if (hdr == "#rv") setCheck(limitVolt_, body.toFloat() / 100.0, 80);
-  else if (hdr == "#ra") setCheck(limitCurr_, body.toFloat() / 100.0, 15);
-  else if (hdr == "#ri") {
-    setCheck(outCurr_, body.toFloat() / 100.0, 15);
+bool Drok::handleReply(const char *msg) {
+  if (!msg || strlen(msg) < 3) return false;
+  float val = atof(msg + 3);
+  if      (!strncmp(msg, "#ro", 3)) setCheck(outEn_, (atoi(msg + 3) == 1), 2);
+  else if (!strncmp(msg, "#ru", 3)) setCheck(outVolt_, val / 100.0, 80);
+  else if (!strncmp(msg, "#rv", 3)) setCheck(limitVolt_, val / 100.0, 80);
+  else if (!strncmp(msg, "#ra", 3)) setCheck(limitCurr_, val / 100.0, 15);
+  else if (!strncmp(msg, "#ri", 3)) {
+    setCheck(outCurr_, val / 100.0, 15);
     doTotals();
   } else {
-    log(getType() + " got unknown msg > '" + hdr + "' / '" + body + "'");
+    logFmt("%s got unknown msg > '%s'", getType(), msg);
     return false;
   }
   lastSuccess_ = millis();
@@ -131,54 +174,114 @@ void Drok::flush() {
   port_->flush();
 }
 
+//queued transactions. writes to a setting that hasn't been sent yet replace
+//it, so a burst of setCurrent() calls only sends the latest. only reads pipeline
+bool Drok::queue(const char *cmd, ReplyFn done, bool pipe) {
+  bool ret = false;
+  if (xSemaphoreTake(lock_, (TickType_t) 100) == pdTRUE) {
+    if (cmd[0] == 'a' && cmd[1] == 'w')
+      for (int i = 0; i < txq_.size() && !ret; i++)
+        if (!strncmp(txq_[i].cmd, cmd, 3)) {
+          strncpy(txq_[i].cmd, cmd, sizeof(txq_[i].cmd) - 1);
+          txq_[i].done = done;
+          ret = true;
+        }
+    if (!ret && !txq_.isFull()) {
+      DrokTxn t = {{0}, done, 0, pipe && cmd[1] == 'r'};
+      strncpy(t.cmd, cmd, sizeof(t.cmd) - 1);
+      ret = txq_.push_back(t);
+    }
+    xSemaphoreGive(lock_);
+  }
+  if (!ret) logFmt("%s queue full, dropping %s", getType(), cmd);
+  return ret;
+}
+
+void Drok::poll() {
+  for (int c; !sent_.empty() && (c = port_->read()) >= 0; ) {
+    if (c == '\n' && rxLen_) finish(true);
+    else if (c != '\r' && c != '\n' && rxLen_ < sizeof(rx_) - 1) rx_[rxLen_++] = c;
+  }
+  if (!sent_.empty() && (millis() - sent_.front().sentAt) > replyTimeout_)
+    finish(false);
+  sendNext();
+}
+
+//one transaction at a time, unless the next ones are pipe-able reads following
+//pipe-able reads. those go out back to back, in a single write
+void Drok::sendNext() {
+  static const int depth = 4;
+  char buf[depth * (sizeof(DrokTxn::cmd) + 2)];
+  size_t len = 0;
+  bool idle = sent_.empty();
+  if (xSemaphoreTake(lock_, (TickType_t) 100) != pdTRUE) return;
+  while (!txq_.empty() && (sent_.empty() || (txq_.front().pipe && sent_.back().pipe && sent_.size() < depth))) {
+    DrokTxn t = txq_.pop_front();
+    t.sentAt = millis();
+    len += snprintf(buf + len, sizeof(buf) - len, "%s\r\n", t.cmd);
+    sent_.push_back(t);
+    txns_++;
+  }
+  xSemaphoreGive(lock_);
+  if (!len) return;
+  if (idle) while (port_->read() >= 0) { } //drop anything stale, eg a late reply we timed out on
+  port_->write((const uint8_t*) buf, len);
+}
+
+//'#ru' answers 'aru', '#wiok' answers 'awi..', but '#ra' answers 'arc'
+bool answers(const char *reply, const char *cmd) {
+  return reply[0] == '#' && reply[1] == cmd[1] && (reply[2] == cmd[2] || (cmd[2] == 'c' && reply[2] == 'a'));
+}
+
+void Drok::finish(bool ok) {
+  rx_[rxLen_] = 0;
+  rxLen_ = 0;
+  int at = 0; //timeouts fail the oldest, replies complete whichever they answer
+  if (ok) while (at < sent_.size() && !answers(rx_, sent_[at].cmd)) at++;
+  if (at == sent_.size()) return logFmt("%s got unmatched reply > '%s'", getType(), rx_);
+  DrokTxn t = sent_[at];
+  for (int i = 0, n = sent_.size(); i < n; i++) { //remove it, keeping order
+    DrokTxn x = sent_.pop_front();
+    if (i != at) sent_.push_back(x);
+  }
+  if (!ok) timeouts_++;
+  if (debug_) logFmt("%s > '%sCRLF' < '%s'%s %dms", getType(), t.cmd, ok? rx_ : "", ok? "" : " TIMEOUT", millis() - t.sentAt);
+  if (t.done) t.done(ok, ok? rx_ : "");
+}
+
+void Drok::await() {
+  while (busy()) {
+    poll();
+    yield();
+  }
+}
+
 String Drok::cmdReply(const String &cmd) {
-  port_->print(cmd + "\r\n");
-  String tolog;
-  if (debug_) tolog += " > '" + cmd + "CRLF'";
   String reply;
-  uint32_t start = millis();
-  char c;
-  while ((millis() - start) < 1000 && !reply.endsWith("\n"))
-    if (port_->readBytes(&c, 1))
-      reply.concat(c);
-  if (debug_ && reply.length()) {
-    tolog += " < '" + reply + "'";
-    tolog.replace("\r", "CR");
-    tolog.replace("\n", "NL");
-    log(getType() + tolog);
-  }
-  if (!reply.length() && debug_ && port_->available())
-    log(getType() + " nothing read.. stuff available!? " + String(port_->available()));
-  reply.trim();
+  if (queue(cmd.c_str(), [&reply](bool ok, const char *r) { if (ok) reply = r; }))
+    await(); //every transaction times out, so this always returns
   return reply;
 }
 
 bool Drok::enableOutput(bool status) {
-  String r = cmdReply(str("awo%d\r\n", status ? 1 : 0));
-  if (r == "#wook") {
-    outEn_ = status;
-    return true;
-  } else return false;
-}
-
-String Drok::fourCharStr(uint16_t input) {
-  char buf[] = "    ";
-  // Iterate through units, tens, hundreds etc
-  for (int digit = 0; digit < 4; digit++)
-    buf[3 - digit] = ((input / ((int) pow(10, digit))) % 10) + '0';
-  return String(buf);
+  return queue(status? "awo1" : "awo0", [this, status](bool ok, const char *r) {
+    if (ok && !strcmp(r, "#wook")) outEn_ = status;
+    else logFmt("%s enableOutput failed", getType());
+  });
 }
 
 bool Drok::setVoltage(float v) {
+  char cmd[12];
+  snprintf(cmd, sizeof(cmd), "awu%04u", ((uint16_t)(v * 100.0)) % 10000);
   limitVolt_ = v;
-  String r = cmdReply("awu" + fourCharStr(v * 100.0));
-  return (r == "#wuok");
+  return queue(cmd, [this](bool ok, const char *r) { if (!ok || strcmp(r, "#wuok")) logFmt("%s setVoltage failed", getType()); });
 }
 
 bool Drok::setCurrent(float v) {
+  char cmd[12];
+  snprintf(cmd, sizeof(cmd), "awi%04u", ((uint16_t)(v * 100.0)) % 10000);
   limitCurr_ = v;
-  String r = cmdReply("awi" + fourCharStr(v * 100.0));
-  return (r == "#wiok");
+  return queue(cmd, [this](bool ok, const char *r) { if (!ok || strcmp(r, "#wiok")) logFmt("%s setCurrent failed", getType()); });
 }
 
 
@@ -191,12 +294,12 @@ DPS::~DPS() { }
 
 bool DPS::begin() {
   bus_->begin(1, *port_);
-  if (doUpdate()) {
+  if (readAll()) {
     if (bus_->readHoldingRegisters(0x000B, 2) == bus_->ku8MBSuccess) {
       uint16_t model = bus_->getResponseBuffer(0);
       uint16_t version = bus_->getResponseBuffer(1);
       dps5020_ = (model == 5020);
-      log(getType() + str(" begin model/version %d %d %d", model, version, dps5020_));
+      logFmt("%s begin model/version %d %d %d", getType(), model, version, dps5020_);
       return true;
     }
   }
@@ -204,7 +307,41 @@ bool DPS::begin() {
 }
 
 bool DPS::doUpdate() {
+  if (!lastFull_ || (millis() - lastFull_) > fullPeriod_)
+    return readAll();
+  return readCurrent();
+}
+
+void filterMs(float &ms, uint32_t start) {
+  float took = millis() - start;
+  ms = ms? ms + 0.2 * (took - ms) : took;
+}
+
+bool DPS::readCurrent() {
+  //registers 2-5: out volts, out amps, power, in volts
+  uint32_t start = millis();
+  try {
+    if (bus_->readHoldingRegisters(0x0002, 4) == bus_->ku8MBSuccess) {
+      outVolt_    = ((float)bus_->getResponseBuffer(0) / 100 );
+      outCurr_    = ((float)bus_->getResponseBuffer(1) / (dps5020_? 100 : 1000) );
+      inputVolts_ = ((float)bus_->getResponseBuffer(3) / 100 );
+      doTotals();
+      lastSuccess_ = millis();
+      fastReads_++;
+      filterMs(fastMs_, start);
+      return true;
+    } else logFmt("%s error fetching registers", getType());
+  } catch (const std::runtime_error &e) {
+    logFmt("%s caught exception in DPS::readCurrent %s", getType(), e.what());
+  } catch (...) {
+    logFmt("%s caught unknown exception in DPS::readCurrent", getType());
+  }
+  return false;
+}
+
+bool DPS::readAll() {
   //read a range of 16-bit registers starting at register 0 to 10
+  uint32_t start = millis();
   try {
     if (bus_->readHoldingRegisters(0x0000, 10) == bus_->ku8MBSuccess) {
       limitVolt_  = ((float)bus_->getResponseBuffer(0) / 100 );
@@ -216,17 +353,25 @@ bool DPS::doUpdate() {
       cc_         = ((bool)bus_->getResponseBuffer(8) );
       outEn_      = ((bool)bus_->getResponseBuffer(9) );
       doTotals();
-      lastSuccess_ = millis();
+      lastSuccess_ = lastFull_ = millis();
+      fullReads_++;
+      filterMs(fullMs_, start);
       return true;
-    } else log(getType() + " error fetching registers");
-  } catch (std::runtime_error e) {
-    log(getType() + " caught exception in DPS::update " + String(e.what()));
+    } else logFmt("%s error fetching registers", getType());
+  } catch (const std::runtime_error &e) {
+    logFmt("%s caught exception in DPS::update %s", getType(), e.what());
   } catch (...) {
-    log(getType() + " caught unknown exception in DPS::update");
+    logFmt("%s caught unknown exception in DPS::update", getType());
   }
   return false;
 }
+
+String DPS::getStats() const {
+  return str("fast read %0.1fms x%d, full read %0.1fms x%d", fastMs_, fastReads_, fullMs_, fullReads_);
+}
+
 bool DPS::enableOutput(bool en) {
+  lastFull_ = 0; //re-read the flags next update
   return bus_->writeSingleRegister(0x0009, en) == bus_->ku8MBSuccess;
 }
 
@@ -234,6 +379,7 @@ bool DPS::setVoltage(float v) {
   return bus_->writeSingleRegister(0x0000, ((limitVolt_ = v)) * 100) == bus_->ku8MBSuccess;
 }
 bool DPS::setCurrent(float c) {
+  lastFull_ = 0; //collapse detection reads cc_, it should be from after the set
   return bus_->writeSingleRegister(0x0001, ((limitCurr_ = c)) * (dps5020_? 100 : 1000)) == bus_->ku8MBSuccess;
 }
 
@@ -1,6 +1,13 @@
 #pragma once
 #include <cstdint>
 #include <WString.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <functional>
+#include <string>
+#include <vector>
+#include "utils.h"
+#include "publishable.h"
 
 class Stream;
 
@@ -14,13 +21,16 @@ class PowerSupply {
     float currFilt_ = 0.0, wh_ = 0;
     bool outEn_ = false;
     uint32_t lastSuccess_ = 0, lastAmpUpdate_ = 0;
+    Publishable *log_ = logger(); //the owning controller's
 
-    static PowerSupply* make(String type);
+    static PowerSupply* make(String type, const std::vector<Stream*> &taken = {}); //taken: ports other supplies are on
     PowerSupply();
     virtual ~PowerSupply();
     virtual bool begin() = 0;
     virtual bool doUpdate() = 0;
     virtual bool readCurrent() { return doUpdate(); };
+    virtual void poll() { } //advances any outstanding async i/o, call often
+    virtual bool isAsync() const { return false; } //set/read calls queue instead of blocking
 
     virtual bool setVoltage(float) = 0;
     virtual bool setCurrent(float) = 0;
@@ -31,10 +41,24 @@ class PowerSupply {
     virtual bool isCollapsed() const;
     virtual bool getInputVolt(float* v) const { return false; }
     virtual String toString() const;
+    virtual void print(StrBuf &) const; //toString, without the heap
+    virtual String getStats() const { return ""; } //comms timing, for psustats
     String getType() const { return type_; }
     virtual bool isDrok() const { return true; }
   protected:
     void doTotals();
+    template<typename... A>
+    void logFmt(const char *fmt, const A&... args) const { log_->logFmt(fmt, args...); }
+    void log(const String &s) const { log_->log(s); }
+};
+
+typedef std::function<void(bool ok, const char *reply)> ReplyFn;
+
+struct DrokTxn {
+  char cmd[12];
+  ReplyFn done;
+  uint32_t sentAt;
+  bool pipe; //may go out while earlier reads are still unanswered
 };
 
 class Drok : public PowerSupply {
@@ -42,21 +66,37 @@ class Drok : public PowerSupply {
     Drok(Stream*);
     ~Drok();
     bool begin() override;
+    void poll() override;
+    bool isAsync() const override { return true; }
 
-    String cmdReply(const String &cmd);
+    bool queue(const char *cmd, ReplyFn done = nullptr, bool pipe = false); //false if the queue is full
+    void await(); //blocks, polling until every queued transaction is done
+    bool busy() const { return !sent_.empty() || !txq_.empty(); }
+    String cmdReply(const String &cmd); //blocking
     bool setVoltage(float) override;
     bool setCurrent(float) override;
     bool enableOutput(bool) override;
 
-    bool doUpdate() override; //runs these next three:
+    bool doUpdate() override; //queues these next three, returns last update's result:
     bool readCurrent() override;
     bool readVoltage();
     bool readOutputEnabled();
     void flush();
+    String getStats() const override;
 
+    bool pipeline_ = false; //reads go out back to back, replies matched by header
+    uint32_t replyTimeout_ = 300, txns_ = 0, timeouts_ = 0;
+    float updateMs_[2] = {0, 0}; //filtered full doUpdate() time: sequential, pipelined
   private:
-    bool handleReply(const String &);
-    String fourCharStr(uint16_t input);
+    bool handleReply(const char *);
+    void sendNext();
+    void finish(bool ok);
+    CircularArray<DrokTxn, 8> txq_, sent_;
+    SemaphoreHandle_t lock_;
+    char rx_[24];
+    uint8_t rxLen_ = 0, updateLeft_ = 0;
+    uint32_t updateStart_ = 0, updates_ = 0;
+    bool updateOk_ = false, lastUpdateOk_ = false;
 };
 
 class ModbusMaster;
@@ -76,9 +116,15 @@ class DPS : public PowerSupply {
     bool setCurrent(float) override;
     bool enableOutput(bool) override;
 
-    bool doUpdate() override; //runs these next three:
+    bool doUpdate() override; //fast read, or a full read every fullPeriod_ ms and after a set
+    bool readCurrent() override; //fast read: output V/I + input volts
+    bool readAll(); //full read: adds limits, CC + enable flags
 
     bool isCC() const override;
+    String getStats() const override;
+
+    uint32_t fullPeriod_ = 2000, lastFull_ = 0, fastReads_ = 0, fullReads_ = 0;
+    float fastMs_ = 0, fullMs_ = 0; //filtered read times
     bool getInputVolt(float* v) const override;
     bool isDrok() const override { return false; }
 };
@@ -2,128 +2,356 @@
 #include "utils.h"
 #include <WiFi.h>
 #include <Preferences.h>
+#include <freertos/task.h>
+#include <memory>
 
 template<typename T>
 struct Pub : PubItem {
   T value;
+  String setTo_; //actions only: what it was last set to, persisted rather than running it to ask
   Pub(String k, T v, int p) : PubItem(k,p), value(v) { }
   ~Pub() { }
   String toString() const override { return String(*value); }
   String jsonValue() const override { return toString(); }
   String set(String v) override { *value = v.toFloat(); return toString(); }
   void const* val() const override { return value; }
-  void save(Preferences&p) override { p.putBytes(key.c_str(), value, sizeof(*value)); }
-  void load(Preferences&p) override { p.getBytes(key.c_str(), value, sizeof(*value)); }
+  int prefBytes(char *buf, size_t len) const override {
+    if (len < sizeof(*value)) return -1;
+    memcpy(buf, value, sizeof(*value));
+    return sizeof(*value);
+  }
+  void loadBytes(const char *buf, size_t len) override { if (len == sizeof(*value)) memcpy(value, buf, len); }
+  bool isAction() const override { return false; }
+  int write(char *buf, size_t len) const override { return -1; }
+  int writeJson(char *buf, size_t len) const override { return write(buf, len); }
+};
+
+//a value read through a getter, with an optional setter
+struct PubFn : PubItem {
+  NumFn get;
+  Action setter;
+  uint8_t digits_ = 2;
+  PubFn(String k, NumFn g, Action s, int p) : PubItem(k,p), get(g), setter(s) { }
+  PubItem& digits(uint8_t d) override { digits_ = d; return *this; }
+  String toString() const override { char buf[24]; return (write(buf, sizeof(buf)) < 0)? String(get()) : String(buf); }
+  String jsonValue() const override { return toString(); }
+  String set(String v) override {
+    if (!v.length()) return toString();
+    if (!setter) throw std::runtime_error("read only");
+    return setter(v);
+  }
+  void const* val() const override { return &get; }
+  int prefBytes(char *buf, size_t len) const override {
+    double v = get();
+    if (len < sizeof(v)) return -1;
+    memcpy(buf, &v, sizeof(v));
+    return sizeof(v);
+  }
+  void loadBytes(const char *buf, size_t len) override {
+    double v;
+    float f;
+    if (!setter) return;
+    if (len == sizeof(v)) memcpy(&v, buf, sizeof(v));
+    else if (len == sizeof(f)) { memcpy(&f, buf, sizeof(f)); v = f; } //saved back when it was a float&
+    else return;
+    setter(String(v, 3));
+  }
   bool isAction() const override { return false; }
+  int write(char *buf, size_t len) const override { //whole numbers print like ints
+    double v = get();
+    int l = snprintf(buf, len, "%.*f", (fabs(v) < 1e9 && v == (int32_t) v)? 0 : digits_, v);
+    return (l < (int) len)? l : -1;
+  }
 };
 
-String prefGetString(Preferences&p, String key) {
-  char buf[128];
-  size_t l = p.getBytes(key.c_str(), buf, 128);
-  if (l == 0) return "";
-  buf[l] = 0; //null terminate
-  return String(buf);
+int writeFmt(char *buf, size_t len, const char *fmt, ...) {
+  va_list args;
+  va_start(args, fmt);
+  int l = vsnprintf(buf, len, fmt, args);
+  va_end(args);
+  return (l >= 0 && l < (int) len)? l : -1;
 }
 
 template<> String Pub<double*>::toString() const { return String(*value, 3); }
+template<> int Pub<double*>::write(char *b, size_t l) const { return writeFmt(b, l, "%.3f", *value); }
+template<> int Pub<float* >::write(char *b, size_t l) const { return writeFmt(b, l, "%.2f", *value); }
+template<> int Pub<int*   >::write(char *b, size_t l) const { return writeFmt(b, l, "%d", *value); }
+template<> int Pub<bool*  >::write(char *b, size_t l) const { return writeFmt(b, l, "%s", (*value)? "true":"false"); }
+template<> int Pub<String*>::write(char *b, size_t l) const { return writeFmt(b, l, "%s", value->c_str()); }
 template<> String Pub<bool* >::toString() const { return (*value)? "true":"false"; }
 template<> String Pub<Action>::toString() const { return (value)(""); }
 template<> String Pub<Action>::jsonValue() const { return "\"" + toString() + "\""; }
 template<> String Pub<bool* >::set(String v) { (*value) = v=="on" || v=="true" || v=="1"; return toString(); }
-template<> String Pub<Action>::set(String v) { return (value)(v); }
+template<> String Pub<Action>::set(String v) {
+  String ret = (value)(v); //may throw, then it isn't remembered
+  if (v.length()) setTo_ = v;
+  return ret;
+}
 template<> void const* Pub<Action>::val() const { return &value; }
 
 template<> bool Pub<Action>::isAction()const { return true; }
-template<> void Pub<Action>::save(Preferences&p) { String v = (value)(""); p.putBytes(key.c_str(), v.c_str(), v.length()); }
-template<> void Pub<Action>::load(Preferences&p) { String v = prefGetString(p, key); if (v.length()) try { (value)(v); } catch(...) { } }
+template<> int Pub<Action>::prefBytes(char *b, size_t l) const { return writeFmt(b, l, "%s", setTo_.c_str()); }
+template<> void Pub<Action>::loadBytes(const char *b, size_t l) { if (l) try { set(b); } catch(...) { } }
 template<> String Pub<String*>::set(String v) { return (*value) = v; }
 template<> String Pub<String*>::toString() const { return (*value); }
 template<> String Pub<String*>::jsonValue() const { return "\"" + toString() + "\""; }
-template<> void Pub<String*>::save(Preferences&p) { p.putBytes(key.c_str(), value->c_str(), value->length()); }
-template<> void Pub<String*>::load(Preferences&p) {
-  (*value) = prefGetString(p, key);
-}
+template<> int Pub<String*>::writeJson(char *b, size_t l) const { return writeFmt(b, l, "\"%s\"", value->c_str()); }
+template<> int Pub<String*>::prefBytes(char *b, size_t l) const { return writeFmt(b, l, "%s", value->c_str()); }
+template<> void Pub<String*>::loadBytes(const char *b, size_t l) { (*value) = b; }
 
 Publishable::Publishable() : lock_(xSemaphoreCreateMutex()) {
+  clearDirty();
+  for (auto &w : stale_) w = ~0u;
   add("save", [this](String s){
-    return str("saved %d prefs", this->savePrefs());
+    saveNow_ = true; //by poll(), so the nvs writes don't hold up whoever runs actions
+    return "saving changed prefs";
   }).hide();
   add("load", [this](String s){
     return str("loaded %d prefs", this->loadPrefs());
   }).hide();
   add("help", [this](String s){ printHelp(); return ""; }).hide();
   add("list", [this](String s){ printHelp(); return ""; }).hide();
+  add("pubbatch", batch_).pref();
+  add("pubcap", capPerMin_).pref();
+  add("savedelay", saveDelay_).pref();
+  add("prefstats", [this](String){ return str("%u pref sets, %u saves, %u changed written, %u unchanged skipped, loaded in %uus",
+      prefSets_, prefSaves_, prefWrites_, prefsUnchanged_, prefLoadUs_); }).hide();
+  add("logdrops", [this]{ return logRings_[0].drops_ + logRings_[1].drops_; });
+  add("logoverruns", [this]{ return logRings_[0].overruns_ + logRings_[1].overruns_; });
+  logDropsPub_ = id("logdrops");
+  logOverrunsPub_ = id("logoverruns");
 }
 
-void Publishable::log(const String &s) {
-  Serial.println(s);
-  if (xSemaphoreTake(lock_, (TickType_t) 100) == pdTRUE) {
-    logPub_.push_back(s);
-    xSemaphoreGive(lock_);
-  }
+LogRing& Publishable::logRing() {
+  return logRings_[(logConsumer_ && xTaskGetCurrentTaskHandle() == logConsumer_)? 1 : 0];
 }
-bool Publishable::popLog(String *s) {
-  if (xSemaphoreTake(lock_, (TickType_t) 100) == pdTRUE) {
-    bool got = logPub_.size() > 0;
-    if (got) (*s) = logPub_.pop_front();
-    xSemaphoreGive(lock_);
-    return got;
-  }
-  return false;
+void Publishable::setLogConsumer() { logConsumer_ = xTaskGetCurrentTaskHandle(); }
+bool Publishable::popLog(char *buf, size_t len) {
+  LogRecord const *a = logRings_[0].peek(), *b = logRings_[1].peek();
+  int r = (a && b)? ((int32_t)(b->ms - a->ms) < 0) : (b != nullptr); //oldest first
+  if (!a && !b) return false;
+  (r? b : a)->format(buf, len);
+  logRings_[r].pop();
+  return true;
 }
-void Publishable::logNote(const String &s) {
+void Publishable::logNote(const char *fmt, ...) {
+  FixedStr<80> note;
+  va_list args;
+  va_start(args, fmt);
+  note.addv(fmt, args);
+  va_end(args);
   if (xSemaphoreTake(lock_, (TickType_t) 100) == pdTRUE) {
-    logNote_ +=  " " + s;
+    notes_.add(" %s", note.c_str());
     xSemaphoreGive(lock_);
-  } else Serial.println("LOGNOTE couldn't get mutex! " + s);
+  } else Serial.printf("LOGNOTE couldn't get mutex! %s\n", note.c_str());
 }
-String Publishable::popNotes() {
+void Publishable::popNotes(StrBuf &s) {
   if (xSemaphoreTake(lock_, (TickType_t) 100) == pdTRUE) {
-    String ret = logNote_;
-    logNote_ = "";
+    s.cat(notes_);
+    notes_.clear();
     xSemaphoreGive(lock_);
-    return ret;
   }
-  return "";
 }
 
-PubItem& Publishable::add(PubItem* p) { items_[p->key] = p; return *p; }
+uint32_t keyHash(const char *k) { //fnv-1a
+  uint32_t h = 2166136261UL;
+  while (*k) h = (h ^ (uint8_t) *k++) * 16777619UL;
+  return h;
+}
+uint32_t addrHash(void const* v) { return ((uintptr_t) v >> 2) * 2654435761UL; }
+static const uint32_t indexMask = PUB_MAX_ITEMS * 2 - 1;
+
+PubItem& Publishable::add(PubItem* p) {
+  PubId existing = id(p->key);
+  if (existing == NO_PUB && count_ >= PUB_MAX_ITEMS)
+    throw std::runtime_error("too many pub items");
+  p->id_ = (existing == NO_PUB)? count_++ : existing;
+  byId_[p->id_] = p;
+  items_[p->key] = p;
+  if (existing == NO_PUB) {
+    uint32_t at = keyHash(p->key.c_str());
+    while (keyIndex_[at & indexMask]) at++;
+    keyIndex_[at & indexMask] = p->id_ + 1;
+  }
+  uint32_t at = addrHash(p->val()); //re-adding the same key leaves a stale (harmless) entry
+  while (addrIndex_[at & indexMask]) at++;
+  addrIndex_[at & indexMask] = p->id_ + 1;
+  return *p;
+}
 PubItem& Publishable::add(String k, double &v, int p) { return add(new Pub<double*>(k,&v,p)); }
 PubItem& Publishable::add(String k, float  &v, int p) { return add(new Pub<float*> (k,&v,p)); }
 PubItem& Publishable::add(String k, int    &v, int p) { return add(new Pub<int*>   (k,&v,p)); }
 PubItem& Publishable::add(String k, bool   &v, int p) { return add(new Pub<bool*>  (k,&v,p)); }
 PubItem& Publishable::add(String k, String &v, int p) { return add(new Pub<String*>(k,&v,p)); }
 PubItem& Publishable::add(String k, Action  v, int p) { return add(new Pub<Action >(k, v,p)); }
+PubItem& Publishable::add(String k, NumFn g, Action s, int p) { return add(new PubFn(k,g,s,p)); }
+
+static uint32_t prefHash(const char *b, size_t l) { //fnv-1a, never 0 so 0 can mean nothing stored
+  uint32_t h = 2166136261UL;
+  while (l--) h = (h ^ (uint8_t) *b++) * 16777619UL;
+  return h? h : 1;
+}
+
+Preferences& Publishable::nvs() {
+  if (!nvs_) {
+    nvs_ = new Preferences();
+    nvs_->begin("Publishable", false); //read-write
+  }
+  return *nvs_;
+}
+
+struct PrefBlobHdr { uint32_t magic; uint8_t version, pad; uint16_t count, len, pad2; uint32_t crc; }; //len, crc: of the entries
+static const uint32_t prefBlobMagic = 0x46525046; //"FPRF"
+static const char* prefBlobKey = "_prefs";
 
 int Publishable::loadPrefs() {
-  Preferences prefs; //destructor calls end()
-  prefs.begin("Publishable", true); //read only
+  uint32_t start = micros();
+  int ret = packPrefs_? loadBlob() : -1;
+  bool blob = ret >= 0;
+  if (!blob) {
+    ret = loadKeys();
+    migrating_ = blobStale_ = packPrefs_ && ret > 0; //first save packs them
+    if (migrating_ && saveDelay_ >= 0) requestSave(); //this boot, not whenever something's next tuned
+  }
+  for (const auto & i : items_)
+    if (i.second->pref_) setDirty(i.second->id_);
+  prefLoadUs_ = micros() - start;
+  Serial.printf("loaded %d prefs from %s in %uus\n", ret, blob? "the blob" : "keys", prefLoadUs_);
+  return ret;
+}
+
+//one read: header, then per pref u8:keylen key u8:len value. keys rather than ids so
+//prefs can come and go between builds. a version it doesn't know, or a bad crc,
+//falls back to per-key prefs
+int Publishable::loadBlob() {
+  size_t len = nvs().getBytesLength(prefBlobKey);
+  if (len < sizeof(PrefBlobHdr) || len > PREF_BLOB_MAX) return -1;
+  std::unique_ptr<uint8_t[]> blob(new uint8_t[len]);
+  PrefBlobHdr h;
+  if (nvs().getBytes(prefBlobKey, blob.get(), len) != len) return -1;
+  memcpy(&h, blob.get(), sizeof(h));
+  const uint8_t *at = blob.get() + sizeof(h), *end = at + h.len;
+  if (h.magic != prefBlobMagic || h.version != PREF_BLOB_VERSION || sizeof(h) + h.len != len || crc32(at, h.len) != h.crc) {
+    Serial.printf("prefs blob unusable (v%d, %u bytes)\n", h.version, (unsigned) len);
+    return -1;
+  }
+  int ret = 0;
+  char key[16], val[PREF_MAX_BYTES + 1];
+  for (int n = 0; n < h.count && at < end; n++) {
+    uint8_t kl = *at++;
+    if (kl >= sizeof(key) || at + kl + 1 > end) break;
+    memcpy(key, at, kl);
+    key[kl] = 0;
+    uint8_t vl = at[kl];
+    at += kl + 1;
+    if (vl > PREF_MAX_BYTES || at + vl > end) break;
+    memcpy(val, at, vl);
+    val[vl] = 0;
+    at += vl;
+    PubId i = id(key);
+    if (i == NO_PUB || !byId_[i]->pref_) continue; //dropped since it was saved
+    prefHash_[i] = prefHash(val, vl);
+    byId_[i]->loadBytes(val, vl);
+    ret++;
+  }
+  return ret;
+}
+
+int Publishable::loadKeys() { //the original layout, a key per pref
+  char buf[PREF_MAX_BYTES + 1];
   int ret = 0;
   for (const auto & i : items_)
     if (i.second->pref_) {
-      i.second->load(prefs);
-      i.second->dirty_ = true;
-      Serial.println("loaded key " + i.first + " to " + i.second->toString());
-      ret++;
+      size_t l = nvs().getBytes(i.first.c_str(), buf, PREF_MAX_BYTES);
+      buf[l] = 0;
+      prefHash_[i.second->id_] = l? prefHash(buf, l) : 0;
+      if (l) i.second->loadBytes(buf, l);
+      if (l) ret++;
     }
   return ret;
 }
+
+bool Publishable::saveBlob(const std::list<std::pair<PubItem*, std::string>> &all) {
+  std::string blob(sizeof(PrefBlobHdr), 0);
+  PrefBlobHdr h = {prefBlobMagic, PREF_BLOB_VERSION, 0, 0, 0, 0, 0};
+  for (const auto &i : all) {
+    if (!i.second.length()) continue; //empty is the same as never set
+    blob += (char) i.first->key.length();
+    blob += i.first->key.c_str();
+    blob += (char) i.second.length();
+    blob += i.second;
+    h.count++;
+  }
+  if (blob.length() > PREF_BLOB_MAX) return false;
+  h.len = blob.length() - sizeof(h);
+  h.crc = crc32((const uint8_t*) blob.data() + sizeof(h), h.len);
+  memcpy(&blob[0], &h, sizeof(h));
+  return nvs().putBytes(prefBlobKey, blob.data(), blob.length()) == blob.length();
+}
+
+//values are read where they're owned (through runner_), only what changed is
+//written, and the writing happens here on the caller's task
 int Publishable::savePrefs() {
-  Preferences prefs;
-  prefs.begin("Publishable", false); //read-write
+  std::list<std::pair<PubItem*, std::string>> changed, all;
+  uint32_t unchanged = 0;
+  auto collect = [&]{
+    char buf[PREF_MAX_BYTES];
+    for (const auto & i : items_) {
+      int l = i.second->pref_? i.second->prefBytes(buf, sizeof(buf)) : -1;
+      if (l < 0) continue;
+      if (packPrefs_) all.emplace_back(i.second, std::string(buf, l));
+      if ((l? prefHash(buf, l) : 0) == prefHash_[i.second->id_]) unchanged++;
+      else changed.emplace_back(i.second, std::string(buf, l));
+    }
+    return String();
+  };
+  saveNow_ = savePending_ = false;
+  runner_? runner_(collect) : collect();
+  prefsUnchanged_ += unchanged;
   int ret = 0;
-  for (const auto & i : items_)
-    if (i.second->pref_) {
-      i.second->save(prefs);
-      Serial.println("saved key " + i.first + " to " + i.second->toString() + str(" (%d free)", prefs.freeEntries()));
-      ret++;
+  if (packPrefs_) { //the whole blob is one write, so one nvs commit however many changed
+    if (!changed.size() && !blobStale_) return 0;
+    if (!saveBlob(all)) {
+      Serial.println("failed saving the prefs blob");
+      return 0;
     }
+    for (const auto &i : all)
+      prefHash_[i.first->id_] = i.second.length()? prefHash(i.second.data(), i.second.length()) : 0;
+    if (migrating_) //the blob has it all now
+      for (const auto &i : all) nvs().remove(i.first->key.c_str());
+    Serial.printf("saved %u changed prefs, %u bytes packed (%u free)\n", (unsigned) changed.size(),
+        (unsigned) nvs().getBytesLength(prefBlobKey), (unsigned) nvs().freeEntries());
+    blobStale_ = migrating_ = false;
+    prefWrites_ += changed.size();
+    prefSaves_++;
+    return changed.size();
+  }
+  for (const auto &c : changed) {
+    const char *k = c.first->key.c_str();
+    bool ok = c.second.length()? nvs().putBytes(k, c.second.data(), c.second.length()) == c.second.length()
+                               : (nvs().remove(k), true); //empty is the same as never set
+    if (!ok) { Serial.printf("failed saving key %s\n", k); continue; }
+    prefHash_[c.first->id_] = c.second.length()? prefHash(c.second.data(), c.second.length()) : 0;
+    Serial.printf("saved key %s (%u free)\n", k, (unsigned) nvs().freeEntries());
+    ret++;
+  }
+  prefWrites_ += ret;
+  if (ret) prefSaves_++;
   return ret;
 }
+
 bool Publishable::clearPrefs() {
-  Preferences prefs;
-  prefs.begin("Publishable", false); //read-write
-  return prefs.clear();
+  for (auto &h : prefHash_) h = 0;
+  blobStale_ = migrating_ = false;
+  return nvs().clear();
+}
+
+//each set pushes the save back, up to 4 delays after the first so constant tuning still lands
+void Publishable::requestSave() {
+  uint32_t now = millis(), latest = (savePending_? saveFirst_ : now) + 4 * saveDelay_;
+  if (!savePending_) saveFirst_ = now;
+  saveAt_ = ((int32_t)(now + saveDelay_ - latest) > 0)? latest : now + saveDelay_;
+  savePending_ = true;
 }
 
 String Publishable::handleCmd(String cmd) {
@@ -134,44 +362,186 @@ String Publishable::handleCmd(String cmd) {
 }
 
 String Publishable::handleSet(String key, String val) {
-  for (auto i : items_)
-    if (i.first == key) {
-      try {
-        String ret = i.second->set(val);
-        i.second->dirty_ = true;
-        return (ret.length())? ret : ("set " + key + " to " + val);
-      } catch (std::runtime_error e) {
-        return "error setting '" + key + "' to '" + val + "': " + String(e.what());
-      }
+  PubId i = id(key);
+  if (i == NO_PUB) return "unknown key " + key;
+  try {
+    PubItem *item = byId_[i];
+    String ret = (runner_ && !item->local_)? runner_([item, &val]{ return item->set(val); }) : item->set(val);
+    setDirty(i);
+    if (item->pref_ && val.length() && saveDelay_ >= 0) {
+      prefSets_++;
+      requestSave();
     }
-  return "unknown key " + key;
+    return (ret.length())? ret : ("set " + key + " to " + val);
+  } catch (const std::runtime_error &e) {
+    return "error setting '" + key + "' to '" + val + "': " + String(e.what());
+  }
 }
 
 std::list<PubItem const*> Publishable::items(bool dirtyOnly) const {
   std::list<PubItem const*> ret;
-  for (const auto & i : items_)
-    if (!dirtyOnly || i.second->dirty_)
-      if (! i.second->hidden_)
-        ret.push_back(i.second);
+  if (dirtyOnly) {
+    for (int i = 0; i < count_; i++)
+      if (isDirty(i) && !byId_[i]->hidden_)
+        ret.push_back(byId_[i]);
+  } else for (const auto & i : items_)
+    if (! i.second->hidden_)
+      ret.push_back(i.second);
+  return ret;
+}
+
+PubId Publishable::id(const String &key) const {
+  for (uint32_t at = keyHash(key.c_str()); keyIndex_[at & indexMask]; at++)
+    if (byId_[keyIndex_[at & indexMask] - 1]->key == key)
+      return keyIndex_[at & indexMask] - 1;
+  return NO_PUB;
+}
+
+PubMask Publishable::mask(std::initializer_list<const char*> keys) const {
+  PubMask ret;
+  for (auto k : keys) {
+    PubId i = id(k);
+    if (i == NO_PUB) Serial.printf("Pub::mask missing key %s\n", k);
+    ret.set(i);
+  }
   return ret;
 }
 
-void Publishable::clearDirty() { for (auto &i : items_) i.second->dirty_ = false; }
-void Publishable::setDirty(std::list<String>dlist) { for (auto i : dlist) setDirty(i); }
+//dirty bits are set from the control loop and cleared by the publisher, so atomics
+void Publishable::setDirty(PubId i) {
+  if (i >= PUB_MAX_ITEMS) return;
+  dirty_[i / 32] |= 1UL << (i % 32);
+  stale_[i / 32] |= 1UL << (i % 32);
+}
+void Publishable::setDirty(const PubMask &m) {
+  for (int w = 0; w < PUB_MAX_ITEMS / 32; w++)
+    if (m.bits[w]) {
+      dirty_[w] |= m.bits[w];
+      stale_[w] |= m.bits[w];
+    }
+}
+void Publishable::setStale(PubId i) {
+  if (i >= PUB_MAX_ITEMS) return;
+  stale_[i / 32] |= 1UL << (i % 32);
+}
+bool Publishable::isDirty(PubId i) const { return i < PUB_MAX_ITEMS && (dirty_[i / 32] & (1UL << (i % 32))); }
+void Publishable::clearDirty() { for (auto &w : dirty_) w = 0; }
+void Publishable::setAllDirty() { for (PubId i = 0; i < count_; i++) setDirty(i); }
+
+int Publishable::publishDirty(const String &feed, const PublishFn &publish, bool batch) {
+  if (feed != topicFeed_ || topicCount_ != count_) { //the only allocations, once per feed change
+    visible_ = PubMask();
+    for (int i = 0; i < count_; i++) {
+      byId_[i]->topic_ = feed + "/" + (byId_[i]->pref_? "prefs/":"") + byId_[i]->key;
+      if (!byId_[i]->hidden_) visible_.set(i);
+    }
+    batchTopic_ = feed + "/telemetry";
+    topicFeed_ = feed;
+    topicCount_ = count_;
+  }
+  uint32_t bits[PUB_MAX_ITEMS / 32], any = 0;
+  for (int w = 0; w < PUB_MAX_ITEMS / 32; w++)
+    any |= bits[w] = dirty_[w].exchange(0) & visible_.bits[w];
+  if (!any) return 0;
+  int wins = batch? publishBatch(bits, publish) : publishEach(bits, publish);
+  for (int w = 0; w < PUB_MAX_ITEMS / 32; w++)
+    if (bits[w]) { //ran out of budget, these go out (with their latest value) next time
+      dirty_[w] |= bits[w];
+      coalesced_ += __builtin_popcount(bits[w]);
+    }
+  return wins;
+}
+
+bool Publishable::takeToken() { //token bucket, holds up to 5s worth
+  if (capPerMin_ <= 0) return true;
+  uint32_t now = millis();
+  float burst = capPerMin_ / 12.0;
+  tokens_ += (now - lastRefill_) * capPerMin_ / 60000.0;
+  if (tokens_ > burst) tokens_ = (burst < 1)? 1 : burst;
+  lastRefill_ = now;
+  if (tokens_ < 1) return false;
+  tokens_ -= 1;
+  return true;
+}
+
+//one message per item, clears bits as they go out
+int Publishable::publishEach(uint32_t *bits, const PublishFn &publish) {
+  int wins = 0;
+  for (int n = 0; n < count_; n++) {
+    PubId id = (cursor_ + n) % count_;
+    uint32_t bit = 1UL << (id % 32);
+    if (!(bits[id / 32] & bit)) continue;
+    if (!takeToken()) { cursor_ = id; return wins; } //so the tail doesn't starve
+    bits[id / 32] &= ~bit;
+    PubItem const* i = byId_[id];
+    if (i->write(scratch_, sizeof(scratch_)) >= 0)
+      wins += publish(i->topic_.c_str(), scratch_)? 1 : 0;
+    else {
+      wins += publish(i->topic_.c_str(), i->toString().c_str())? 1 : 0;
+      fallbacks_++;
+    }
+    published_++;
+  }
+  return wins;
+}
+
+//packs items into {"key":value,"prefs/key":value} messages, as few as fit
+int Publishable::publishBatch(uint32_t *bits, const PublishFn &publish) {
+  if (!takeToken()) return 0;
+  int wins = 0;
+  size_t len = 0;
+  for (int id = 0; id < count_; id++) {
+    uint32_t bit = 1UL << (id % 32);
+    if (!(bits[id / 32] & bit)) continue;
+    PubItem const* i = byId_[id];
+    String fallback;
+    if (i->writeJson(scratch_, sizeof(scratch_)) < 0) {
+      fallback = i->jsonValue();
+      fallbacks_++;
+    }
+    const char *k = i->topic_.c_str() + topicFeed_.length() + 1, *v = fallback.length()? fallback.c_str() : scratch_;
+    size_t need = strlen(k) + strlen(v) + 4; //sep "key":
+    if (len && len + need + 1 >= sizeof(batchBuf_)) { //full, send what we have
+      wins += sendBatch(len, publish)? 1 : 0;
+      len = 0;
+      if (!takeToken()) return wins;
+    }
+    bits[id / 32] &= ~bit;
+    if (need + 1 >= sizeof(batchBuf_)) continue; //never fits, dropped
+    len += sprintf(batchBuf_ + len, "%c\"%s\":%s", len? ',' : '{', k, v);
+  }
+  if (len) wins += sendBatch(len, publish)? 1 : 0;
+  return wins;
+}
+
+bool Publishable::sendBatch(size_t len, const PublishFn &publish) {
+  batchBuf_[len] = '}';
+  batchBuf_[len + 1] = 0;
+  published_++;
+  return publish(batchTopic_.c_str(), batchBuf_);
+}
+
 void Publishable::setDirty(String key) {
-  auto it = items_.find(key);
-  if (it != items_.end()) it->second->dirty_ = true;
+  PubId i = id(key);
+  if (i != NO_PUB) setDirty(i);
   else Serial.println("Pub::setDirty missing key" + key);
 }
 void Publishable::setDirtyAddr(void const* v) {
-  for (const auto & i : items_)
-    if (v == i.second->val())
-      { i.second->dirty_ = true; return; }
+  for (uint32_t at = addrHash(v); addrIndex_[at & indexMask]; at++)
+    if (byId_[addrIndex_[at & indexMask] - 1]->val() == v)
+      return setDirty(addrIndex_[at & indexMask] - 1);
   Serial.printf("Pub::setDirty missing addr %p\n", v);
 }
 
 void Publishable::poll(Stream* stream) {
   static String buff;
+  if (saveNow_ || (savePending_ && (int32_t)(millis() - saveAt_) >= 0)) {
+    try { savePrefs(); }
+    catch (std::runtime_error &e) { //runner_ couldn't get to it, try again later
+      Serial.printf("pref save failed: %s\n", e.what());
+      requestSave();
+    }
+  }
   if (stream->available()) { //cmd val
     buff += stream->readString();
     int end = -1;
@@ -196,16 +566,94 @@ void Publishable::printHelp() const {
     Serial.println("** IP: " + WiFi.localIP().toString());
 }
 
-String Publishable::toJson() const {
-  String ret = "{\n";
+//re-serializes i if it was marked since, true if that changed what it says
+bool Publishable::refresh(PubItem *i) {
+  uint32_t bit = 1UL << (i->id_ % 32);
+  if (!(stale_[i->id_ / 32].fetch_and(~bit) & bit)) return false;
+  char buf[64];
+  if (i->writeJson(buf, sizeof(buf)) >= 0) {
+    if (i->json_ == buf) return false;
+    i->json_ = buf; //String keeps its capacity, so this settles into not allocating
+  } else {
+    String v = i->jsonValue();
+    if (v == i->json_) return false;
+    i->json_ = v;
+  }
+  if (!i->hidden_) {
+    changed_.set(i->id_);
+    docVersion_++;
+  }
+  return true;
+}
+
+const char* Publishable::cachedJson(PubItem *i) {
+  refresh(i);
+  return i->json_.c_str();
+}
+
+uint32_t Publishable::docVersion() {
+  if (docCount_ != count_) { //added since
+    docCount_ = count_;
+    docVersion_++;
+  }
+  for (int w = 0; w < PUB_MAX_ITEMS / 32; w++)
+    for (uint32_t bits = stale_[w]; bits; bits &= bits - 1) {
+      int id = w * 32 + __builtin_ctz(bits);
+      if (id < count_ && !byId_[id]->hidden_) refresh(byId_[id]); //hidden actions only run when asked
+    }
+  return docVersion_;
+}
+
+//small writes gathered into fewer, bigger chunks
+struct ChunkBuf {
+  const ChunkFn &out_;
+  char buf_[256];
+  size_t len_ = 0;
+  ChunkBuf(const ChunkFn &out) : out_(out) { }
+  ~ChunkBuf() { if (len_) out_(buf_, len_); }
+  ChunkBuf& operator<<(const char *s) {
+    size_t l = strlen(s);
+    if (len_ + l > sizeof(buf_)) {
+      if (len_) out_(buf_, len_);
+      len_ = 0;
+    }
+    if (l > sizeof(buf_)) out_(s, l);
+    else {
+      memcpy(buf_ + len_, s, l);
+      len_ += l;
+    }
+    return *this;
+  }
+};
+
+void Publishable::streamJson(const ChunkFn &out) {
+  ChunkBuf b(out);
+  b << "{\n";
   for (const auto & i : items_)
     if (!i.second->hidden_ && !i.second->pref_)
-      ret += "  \"" + i.first + "\":" + i.second->jsonValue() + ",\n";
-  ret += "\"prefs\":{\n";
+      b << "  \"" << i.first.c_str() << "\":" << cachedJson(i.second) << ",\n";
+  b << "\"prefs\":{\n";
+  bool first = true;
   for (const auto & i : items_)
-    if (!i.second->hidden_ && i.second->pref_)
-      ret += "    \"" + i.first + "\":" + i.second->jsonValue() + ",\n";
-  ret.remove(ret.length() - 2, 2); //remove trailing comma + LF
-  ret += "  }\n";
-  return ret + "\n}\n";
+    if (!i.second->hidden_ && i.second->pref_) {
+      b << (first? "    \"" : ",\n    \"") << i.first.c_str() << "\":" << cachedJson(i.second);
+      first = false;
+    }
+  b << "\n  }\n\n}\n";
+}
+
+bool Publishable::popChanges(const ChunkFn &out) {
+  docVersion(); //picks up whatever was marked
+  bool any = false;
+  {
+    ChunkBuf b(out);
+    for (int id = 0; id < count_; id++)
+      if (changed_.test(id)) {
+        b << (any? ",\"" : "{\"") << byId_[id]->key.c_str() << "\":" << byId_[id]->json_.c_str();
+        any = true;
+      }
+    if (any) b << "}";
+  }
+  changed_ = PubMask();
+  return any;
 }
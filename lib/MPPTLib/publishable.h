@@ -1,11 +1,14 @@
 #pragma once
-#include <WString.h>
+#include <Arduino.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/semphr.h>
 #include <functional>
+#include <atomic>
 #include <map>
 #include <list>
+#include <string>
 #include "utils.h"
+#include "logRing.h"
 
 class Stream;
 class PubSubClient;
@@ -14,23 +17,48 @@ class Preferences;
 typedef std::function<String(String)> Action;
 typedef std::function<String()> StrFn;
 typedef std::function<void(String)> SetFn;
+typedef std::function<double()> NumFn;
+typedef std::function<bool(const char *topic, const char *payload)> PublishFn;
+typedef std::function<void(const char *, size_t)> ChunkFn;
+typedef std::function<String(const StrFn &)> RunFn; //runs fn somewhere, returns what it did
 
 #define DEFAULT_PERIOD -1
+#define PUB_MAX_ITEMS 128
+#define PUB_BATCH_SIZE 512 //largest batched message, the mqtt client buffer needs room for it
+#define PREF_MAX_BYTES 128 //largest persisted value
+#define PREF_BLOB_VERSION 1
+#define PREF_BLOB_MAX 2048 //packed prefs, see Publishable::loadBlob
+
+typedef uint8_t PubId; //dense handle, index into the registry
+static constexpr PubId NO_PUB = 0xFF;
+
+struct PubMask { //one bit per PubId
+  uint32_t bits[PUB_MAX_ITEMS / 32] = {0};
+  void set(PubId i) { if (i < PUB_MAX_ITEMS) bits[i / 32] |= 1UL << (i % 32); }
+  bool test(PubId i) const { return i < PUB_MAX_ITEMS && (bits[i / 32] & (1UL << (i % 32))); }
+};
 
 struct PubItem {
   String key;
   int period;
-  bool pref_, hidden_, dirty_;
-  PubItem(String k, int p) : key(k), period(p), pref_(false), hidden_(false), dirty_(false) { }
+  bool pref_, hidden_, local_;
+  PubId id_;
+  String topic_; //full mqtt topic, rebuilt when the feed changes
+  String json_; //cached jsonValue(), refreshed after the item is marked dirty
+  PubItem(String k, int p) : key(k), period(p), pref_(false), hidden_(false), local_(false), id_(NO_PUB) { }
   virtual ~PubItem() { }
   virtual String toString() const = 0;
+  virtual int write(char *buf, size_t len) const { return -1; } //toString without the heap, -1 if it can't
+  virtual int writeJson(char *buf, size_t len) const { return write(buf, len); }
   virtual String jsonValue() const = 0;
   virtual String set(String v) = 0;
   virtual void const* val() const = 0;
-  virtual void save(Preferences&) = 0;
-  virtual void load(Preferences&) = 0;
+  virtual int prefBytes(char *buf, size_t len) const = 0; //what gets persisted, -1 if it doesn't fit
+  virtual void loadBytes(const char *buf, size_t len) = 0; //buf is also null terminated
   virtual PubItem& pref() { pref_ = true; return *this; }
   virtual PubItem& hide() { hidden_ = true; return *this; }
+  virtual PubItem& local() { local_ = true; return *this; } //set on the calling task, never through runner_
+  virtual PubItem& digits(uint8_t) { return *this; } //decimals a getter's value prints with, 2 unless whole
   virtual bool isAction() const = 0;
 };
 
@@ -38,41 +66,103 @@ class Publishable {
 public:
   Publishable();
 
-  //TODO support publishing cap in msgs/minute
-
   PubItem& add(String name, double &, int pubPeriod = DEFAULT_PERIOD);
   PubItem& add(String name, float &, int pubPeriod = DEFAULT_PERIOD);
   PubItem& add(String name, int &, int pubPeriod = DEFAULT_PERIOD);
   PubItem& add(String name, bool &, int pubPeriod = DEFAULT_PERIOD);
   PubItem& add(String name, String &, int pubPeriod = DEFAULT_PERIOD);
   PubItem& add(String name, Action, int pubPeriod = DEFAULT_PERIOD);
+  PubItem& add(String name, NumFn get, Action set = nullptr, int pubPeriod = DEFAULT_PERIOD); //numeric getter, publishes without allocating
 
   void poll(Stream*);
   String handleCmd(String cmd);
   String handleSet(String key, String val);
-  String toJson() const;
+  void streamJson(const ChunkFn &); //the status document in chunks, only changed items re-serialize
+  uint32_t docVersion(); //moves when what streamJson would send does. re-serializes the marked items, never the document
+  bool popChanges(const ChunkFn &); //{"key":value,...} on one line, what changed since the last call. false if nothing
   int loadPrefs();
-  int savePrefs();
+  int savePrefs(); //writes only the prefs whose bytes changed, returns how many
   bool clearPrefs();
+  bool savePending() const { return saveNow_ || savePending_; }
   std::list<PubItem const*> items(bool dirtyOnly=true) const;
+  PubId id(const String &key) const; //O(1), NO_PUB if missing
+  PubMask mask(std::initializer_list<const char*> keys) const;
+  void setDirty(PubId);
+  void setDirty(const PubMask &);
   void setDirty(String key);
   void setDirtyAddr(void const*);
-  void setDirty(std::list<String>);
+  void setStale(PubId); //refreshes its json (web, events) without publishing it
+  bool isDirty(PubId) const;
   void clearDirty();
+  void setAllDirty();
+  int publishDirty(const String &feed, const PublishFn &fn) { return publishDirty(feed, fn, batch_); }
+  int publishDirty(const String &feed, const PublishFn &, bool batch); //returns # messages sent ok
+  bool batch_ = false; //all dirty items in one json message on <feed>/telemetry
+  int capPerMin_ = 0; //message budget, 0 is unlimited. when over it updates coalesce into later cycles
+  uint32_t published_ = 0, fallbacks_ = 0, coalesced_ = 0; //fallbacks had to build a String to publish
+  RunFn runner_; //if set, every set/action goes through it (onto the task that owns the values), except local() ones
+  int saveDelay_ = 3000; //ms of quiet after a pref is set before it's written, sets in a burst share one save
+  bool packPrefs_ = true; //all prefs in one checksummed nvs blob rather than a key each, set before loadPrefs()
+  uint32_t prefSets_ = 0, prefSaves_ = 0, prefWrites_ = 0, prefsUnchanged_ = 0; //unchanged were skipped
+  uint32_t prefLoadUs_ = 0;
   void printHelp() const;
 
-  void log(const String &);
-  bool popLog(String*);
-  void logNote(const String &); //adds note to next status
-  String popNotes();
+  template<typename... A>
+  void logFmt(const char *fmt, const A&... args) { //fmt must be a literal, args are copied
+    LogRing &r = logRing();
+    uint32_t overruns = r.overruns_;
+    if (!r.push(millis(), fmt, args...)) setDirty(logDropsPub_);
+    else if (r.overruns_ != overruns) setDirty(logOverrunsPub_);
+  }
+  void log(const String &s) { logFmt("%s", s); }
+  bool popLog(char *buf, size_t len); //formats the oldest, consumer task only
+  void setLogConsumer(); //the calling task formats logs, and gets its own ring to log into
+  void logNote(const char *fmt, ...) PRINTF_FMT(2, 3); //adds note to next status
+  void popNotes(StrBuf &);
   // void log(const char *fmtStr, ...);
 
 private:
   PubItem& add(PubItem*);
-  std::map<String, PubItem*> items_;
+  bool takeToken();
+  int publishEach(uint32_t *bits, const PublishFn &);
+  int publishBatch(uint32_t *bits, const PublishFn &);
+  bool sendBatch(size_t len, const PublishFn &);
+  void requestSave();
+  int loadBlob(); //-1 if there's no usable blob
+  int loadKeys();
+  bool saveBlob(const std::list<std::pair<PubItem*, std::string>> &all);
+  Preferences& nvs(); //opened once, read-write
+  std::map<String, PubItem*> items_; //sorted, for listing
+  PubItem* byId_[PUB_MAX_ITEMS] = {0};
+  uint8_t keyIndex_[PUB_MAX_ITEMS * 2] = {0}, addrIndex_[PUB_MAX_ITEMS * 2] = {0}; //open addressing, id + 1
+  std::atomic<uint32_t> dirty_[PUB_MAX_ITEMS / 32];
+  std::atomic<uint32_t> stale_[PUB_MAX_ITEMS / 32]; //json_ needs a refresh, set alongside dirty_
+  const char* cachedJson(PubItem*);
+  bool refresh(PubItem*);
+  PubMask changed_; //visible items whose json changed since the last popChanges
+  uint32_t docVersion_ = 1; //bumped by each such change. only the task serving http touches these
+  int docCount_ = 0;
+  int count_ = 0, topicCount_ = 0;
+  String topicFeed_, batchTopic_;
+  PubMask visible_; //not hidden, rebuilt with the topics
+  PubId cursor_ = 0; //where a budget-limited cycle left off
+  float tokens_ = 0;
+  uint32_t lastRefill_ = 0;
+  char scratch_[64], batchBuf_[PUB_BATCH_SIZE]; //only touched by the publishing task
   int defaultPeriod_ = 12000;
-  String logNote_;
-  CircularArray<String, 16> logPub_;
+  FixedStr<200> notes_;
+  LogRing& logRing();
+  LogRing logRings_[2]; //[0] everyone else (the control loop), [1] the consumer
+  void* logConsumer_ = nullptr;
+  PubId logDropsPub_ = NO_PUB, logOverrunsPub_ = NO_PUB;
+  Preferences *nvs_ = nullptr;
+  uint32_t prefHash_[PUB_MAX_ITEMS] = {0}; //of the bytes in nvs, 0 when there are none
+  bool savePending_ = false, blobStale_ = false, migrating_ = false; //migrating: per-key prefs go once the blob lands
+  uint32_t saveAt_ = 0, saveFirst_ = 0;
+  std::atomic<bool> saveNow_{false};
   SemaphoreHandle_t lock_;
 };
 
+Publishable* logger(); //whatever addLogger() registered
+template<typename... A>
+void logFmt(const char *fmt, const A&... args) { logger()->logFmt(fmt, args...); }
@@ -0,0 +1,89 @@
+#include "scheduler.h"
+#include <Arduino.h>
+#include "utils.h"
+#include <stdexcept>
+
+static bool reached(uint32_t now, uint32_t due) { return (int32_t)(now - due) >= 0; }
+
+Scheduler::JobId Scheduler::add(const char *name, const int *periodMs, uint8_t priority, JobFn fn, bool backoff) {
+  if (count_ >= SCHED_MAX_JOBS) throw std::runtime_error("too many scheduler jobs");
+  Job &j = jobs_[count_];
+  j = Job();
+  j.name = name;
+  j.fn = fn;
+  j.period = periodMs;
+  j.priority = priority;
+  j.backoff = backoff;
+  j.due = millis();
+  return count_++;
+}
+
+Scheduler::JobId Scheduler::add(const char *name, int periodMs, uint8_t priority, JobFn fn, bool backoff) {
+  JobId id = add(name, (const int*) nullptr, priority, fn, backoff);
+  jobs_[id].fixed = periodMs;
+  return id;
+}
+
+void Scheduler::at(JobId id, uint32_t due) {
+  uint32_t now = millis();
+  jobs_[id].due = reached(now, due)? now : due; //lateness only counts from when it was asked for
+  jobs_[id].moved = true;
+}
+
+void Scheduler::after(JobId id, uint32_t ms) { at(id, millis() + ms); }
+
+uint32_t Scheduler::periodOf(JobId id) const {
+  const Job &j = jobs_[id];
+  uint32_t p = max(j.period? *j.period : j.fixed, 1);
+  return (j.backoff && backoff_)? backoff_(p) : p;
+}
+
+uint32_t Scheduler::run() {
+  uint32_t ran = 0; //bitmask, nothing runs twice per call
+  while (true) {
+    uint32_t now = millis();
+    int pick = -1;
+    for (int i = 0; i < count_; i++) {
+      const Job &j = jobs_[i];
+      if ((ran & (1 << i)) || !reached(now, j.due)) continue;
+      if (pick < 0 || j.priority < jobs_[pick].priority ||
+          (j.priority == jobs_[pick].priority && (int32_t)(j.due - jobs_[pick].due) < 0))
+        pick = i;
+    }
+    if (pick < 0) break;
+    Job &j = jobs_[pick];
+    ran |= 1 << pick;
+    uint32_t late = now - j.due, period = periodOf(pick);
+    j.moved = false;
+    running_ = pick;
+    j.fn();
+    running_ = -1;
+    uint32_t took = millis() - now;
+    j.runs++;
+    j.lateSum += late;
+    j.lateMax = max(j.lateMax, late);
+    j.runMax = max(j.runMax, took);
+    if (late >= period) j.overruns++;
+    if (!j.moved) j.due = now + periodOf(pick); //re-read, the job may have changed backoff
+  }
+  uint32_t now = millis(), idle = UINT32_MAX;
+  for (int i = 0; i < count_; i++)
+    idle = reached(now, jobs_[i].due)? 0 : min(idle, jobs_[i].due - now);
+  return (idle == UINT32_MAX)? 0 : idle;
+}
+
+void Scheduler::print(StrBuf &s) const {
+  for (int i = 0; i < count_; i++) {
+    const Job &j = jobs_[i];
+    s.add("%s%s: %u runs, late %0.1fms avg %ums max, %u overruns, longest run %ums", i? "\n" : "", j.name,
+        j.runs, j.runs? j.lateSum / (double) j.runs : 0.0, j.lateMax, j.overruns, j.runMax);
+  }
+}
+
+void Scheduler::resetStats() {
+  for (int i = 0; i < count_; i++) {
+    Job &j = jobs_[i];
+    j.runs = j.overruns = j.lateMax = j.runMax = 0;
+    j.lateSum = 0;
+  }
+}
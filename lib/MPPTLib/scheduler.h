@@ -0,0 +1,50 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+
+class StrBuf;
+
+#define SCHED_MAX_JOBS 8
+
+//deadline scheduler for the control loop. due times are millis() compared as signed
+//differences, so the 49 day wraparound is a non-event. of the jobs that are due the
+//lowest priority number runs first, then the earliest deadline; each runs at most once
+//per run(). next due is start + period unless the job moved itself while running
+class Scheduler {
+public:
+  typedef std::function<void()> JobFn;
+  typedef std::function<uint32_t(uint32_t)> BackoffFn; //period in, stretched period out
+  typedef int8_t JobId;
+
+  struct Job {
+    const char *name;
+    JobFn fn;
+    const int *period; //ms, read every run so pref changes apply. null uses fixed
+    int fixed;
+    uint8_t priority;
+    bool backoff; //period goes through backoff_
+    bool moved; //rescheduled while running
+    uint32_t due;
+    uint32_t runs, overruns; //overrun: started a whole period or more late
+    uint32_t lateMax, runMax; //ms
+    uint64_t lateSum;
+  };
+
+  BackoffFn backoff_;
+
+  JobId add(const char *name, const int *periodMs, uint8_t priority, JobFn fn, bool backoff = false);
+  JobId add(const char *name, int periodMs, uint8_t priority, JobFn fn, bool backoff = false);
+  void at(JobId id, uint32_t due); //in the past means now
+  void after(JobId id, uint32_t ms); //from now
+  uint32_t run(); //runs what's due, returns ms until the next deadline
+  uint32_t periodOf(JobId id) const;
+  void print(StrBuf &) const; //per job timing stats
+  void resetStats();
+  const Job& job(JobId id) const { return jobs_[id]; }
+  int count() const { return count_; }
+  JobId running() const { return running_; } //-1 outside of run()
+private:
+  Job jobs_[SCHED_MAX_JOBS];
+  int count_ = 0;
+  JobId running_ = -1;
+};
@@ -0,0 +1,35 @@
+#pragma once
+#include <atomic>
+#include <type_traits>
+
+//one writer publishes a plain struct, any number of readers copy it out without
+//locking. the counter is odd while a write is in progress, a reader that saw it
+//odd or saw it change retries. the writer never waits, so the control task can't
+//be held up by a slow publisher
+template<typename T>
+class SeqLock {
+  static_assert(std::is_trivially_copyable<T>::value, "SeqLock copies T bytewise");
+  std::atomic<uint32_t> seq_;
+  T val_;
+public:
+  SeqLock() : seq_(0), val_() { }
+  void write(const T &v) { //single writer only
+    uint32_t s = seq_.load(std::memory_order_relaxed);
+    seq_.store(s + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    val_ = v;
+    seq_.store(s + 2, std::memory_order_release);
+  }
+  T read() const {
+    T ret;
+    uint32_t before, after;
+    do {
+      before = seq_.load(std::memory_order_acquire);
+      ret = val_;
+      std::atomic_thread_fence(std::memory_order_acquire);
+      after = seq_.load(std::memory_order_relaxed);
+    } while ((before & 1) || before != after);
+    return ret;
+  }
+  uint32_t writes() const { return seq_.load(std::memory_order_relaxed) / 2; }
+};
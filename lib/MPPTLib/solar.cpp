@@ -7,38 +7,57 @@
 #include <Update.h>
 #include <esp_task_wdt.h>
 #include <HTTPUpdate.h>
+#include <freertos/task.h>
+#include <lwip/sockets.h>
+#include <algorithm>
 
-using namespace std::placeholders;
-#define ckPSUs() if (!psu_) { return String("no psu"); }
+#define ckPSUs() auto &psu_ = ch_[0].psu_; if (!psu_) { return String("no psu"); } //the unnumbered commands are channel 0's
+#define ckDrok() auto drok = dynamic_cast<Drok*>(ch_[0].psu_.get()); if (!drok) { return String("no drok psu"); }
 
 WiFiClient espClient;
 
+Channel::Channel() :
+        tracker_(new SetpointTracker()),
+        state_(States::off),
+        adc_([this]{ return analogRead(pinInvolt_); }) { }
+Channel::~Channel() { }
+
 Solar::~Solar() { }
 
 Solar::Solar(String version) :
         version_(version),
-        state_(States::off),
+        cmdsWaiting_(0),
+        cmdLock_(xSemaphoreCreateMutex()),
         server_(80),
         pub_() {
   db_.client.setClient(espClient);
+  db_.client.setBufferSize(PUB_BATCH_SIZE + 128); //batched telemetry + topic + header
+  static const char *stageNames[Stages::count] = {"loop", "measure", "adjust", "psu", "print", "publish"};
+  for (int i = 0; i < Stages::count; i++) lat_[i].name_ = stageNames[i];
+  for (int i = 0; i < SOLAR_MAX_CHANNELS; i++) {
+    ch_[i].n_ = i;
+    ch_[i].pinInvolt_ = 32 + i; //32-35, all ADC1
+  }
+  addJobs();
 }
 
-// void runLoop(void*c) { ((Solar*)c)->loopTask(); }
+void runControl(void*c) { ((Solar*)c)->controlTask(); }
 void runPubt(void*c) { ((Solar*)c)->publishTask(); }
 
-//TODO: make these class members instead?
-uint32_t nextVmeas_ = 0, nextPub_ = 20000, nextPrint_ = 0;
-uint32_t nextPSUpdate_ = 0, nextSolarAdjust_ = 1000;
-uint32_t nextAutoSweep_ = 0, lastAutoSweep_ = 0;
 extern const String updateIndex;
 String doOTAUpdate_ = "";
 uint32_t espSketchSize_ = 0;
 
+RTC_NOINIT_ATTR Checkpoint checkpoint_[SOLAR_MAX_CHANNELS];
+static const uint32_t checkpointMagic = 0x4b504843; //"CHPK"
+
 class Backoff : public std::runtime_error { public:
   Backoff(String s) : std::runtime_error(s.c_str()) { }
 };
 
 void Solar::setup() {
+  bootMs_ = millis();
+  etagSalt_ = esp_random(); //so versions from before a restart never match
   Serial.begin(115200);
   Serial.setTimeout(10); //very fast, need to keep the ctrl loop running
   addLogger(&pub_); //sets global context
@@ -59,18 +78,22 @@ void Solar::setup() {
   pub_.add("mqttUser", db_.user).hide().pref();
   pub_.add("mqttPass", db_.pass).hide().pref();
   pub_.add("mqttFeed", db_.feed).hide().pref();
-  pub_.add("inPin",    pinInvolt_).pref();
-  pub_.add("lvProtect", std::bind(&Solar::setLVProtect, this, _1)).pref();
-  pub_.add("psu",       std::bind(&Solar::setPSU, this, _1)).pref();
-  pub_.add("outputEN",[=](String s){ ckPSUs(); if (s.length()) psu_->enableOutput(s == "on"); return String(psu_->outEn_); });
-  pub_.add("outvolt", [=](String s){ ckPSUs(); if (s.length()) psu_->setVoltage(s.toFloat()); return String(psu_->outVolt_); });
-  pub_.add("outcurr", [=](String s){ ckPSUs(); if (s.length()) psu_->setCurrent(s.toFloat()); return String(psu_->outCurr_); });
-  pub_.add("outpower",[=](String){ ckPSUs(); return String(psu_->outVolt_ * psu_->outCurr_); });
-  pub_.add("currFilt",[=](String){ ckPSUs(); return String(psu_->currFilt_); });
-  pub_.add("state",      state_          );
+  pub_.add("inPin",    ch_[0].pinInvolt_).pref();
+  pub_.add("lvProtect",[=](String s){ return s.length()? setLVProtect(s) : String(settings().lvProtect); }).pref();
+  pub_.add("psu",[=](String s){ return s.length()? setPSU(ch_[0], s) : String(settings().psu[0]); }).pref();
+  for (int i = 1; i < SOLAR_MAX_CHANNELS; i++) { //more strings, each on its own uart (psu2=drok:16,17sw)
+    pub_.add(str("psu%d", i + 1),[=](String s){ return s.length()? setPSU(ch_[i], s) : String(settings().psu[i]); }).pref();
+    pub_.add(str("inPin%d", i + 1), ch_[i].pinInvolt_).pref();
+  }
+  pub_.add("outputEN",[=]{ return telemetry().ch[0].outEn; }, [=](String s){ ckPSUs(); psu_->enableOutput(s == "on"); return String(psu_->outEn_); });
+  pub_.add("outvolt", [=]{ return telemetry().ch[0].outVolt; }, [=](String s){ ckPSUs(); psu_->setVoltage(s.toFloat()); return String(psu_->outVolt_); });
+  pub_.add("outcurr", [=]{ return telemetry().ch[0].outCurr; }, [=](String s){ ckPSUs(); psu_->setCurrent(s.toFloat()); return String(psu_->outCurr_); });
+  pub_.add("outpower",[=]{ Telemetry t = telemetry(); return t.ch[0].outVolt * t.ch[0].outCurr; });
+  pub_.add("currFilt",[=]{ return telemetry().ch[0].currFilt; });
+  pub_.add("state",[=](String){ return String(telemetry().ch[0].state); });
   pub_.add("pgain",      pgain_          ).pref();
   pub_.add("ramplimit",  ramplimit_      ).pref();
-  pub_.add("setpoint",   setpoint_       ).pref();
+  pub_.add("setpoint",[=]{ return telemetry().ch[0].setpoint; }, [=](String s){ ch_[0].setpoint_ = s.toFloat(); return String(ch_[0].setpoint_, 3); }).pref();
   pub_.add("vadjust",    vadjust_        ).pref();
   pub_.add("printperiod",printPeriod_    ).pref();
   pub_.add("pubperiod",  db_.period      ).pref();
@@ -78,28 +101,127 @@ void Solar::setup() {
   pub_.add("measperiod", measperiod_     ).pref();
   pub_.add("autosweep",  autoSweep_      ).pref();
   pub_.add("currentcap", currentCap_     ).pref();
-  pub_.add("offthreshold",offThreshold_  ).pref();
-  pub_.add("involt",  inVolt_);
-  pub_.add("wh", [=](String s) { ckPSUs(); if (s.length()) psu_->wh_ = s.toFloat(); return String(psu_->wh_); });
-  pub_.add("collapses", [=](String) { return String(getCollapses()); });
-  pub_.add("sweep",[=](String){ startSweep(); return "starting sweep"; }).hide();
-  pub_.add("connect",[=](String s){ doConnect(); return "connected"; }).hide();
-  pub_.add("disconnect",[=](String s){ db_.client.disconnect(); WiFi.disconnect(); return "dissed"; }).hide();
+  pub_.add("bankcap",    bankCap_        ).pref();
+  pub_.add("offthreshold",[=]{ return telemetry().ch[0].offThreshold; }, [=](String s){ ch_[0].offThreshold_ = s.toFloat(); return String(ch_[0].offThreshold_); }).pref();
+  pub_.add("involt", [=]{ return telemetry().ch[0].inVolt; });
+  pub_.add("sweepmode",[=](String s){ //gets run on the publish task, they read the settings snapshot
+    if (!s.length()) return String(settings().sweepMode);
+    if (s != "linear" && s != "golden") throw std::runtime_error("sweepmode is linear or golden");
+    sweepMode_ = s;
+    snapshotSettings();
+    return sweepMode_;
+  }).pref();
+  pub_.add("tracker",[=](String s){
+    if (!s.length()) return String(settings().tracker);
+    if (s != ch_[0].tracker_->name()) {
+      std::unique_ptr<Tracker> t(Tracker::make(s));
+      if (!t) throw std::runtime_error(str("tracker is %s", Tracker::names).c_str());
+      ch_[0].tracker_ = std::move(t);
+      for (int i = 1; i < SOLAR_MAX_CHANNELS; i++) ch_[i].tracker_.reset(Tracker::make(s)); //same strategy, each its own history
+      logFmt("tracker now %s", ch_[0].tracker_->name());
+      snapshotSettings();
+    }
+    return String(ch_[0].tracker_->name());
+  }).pref();
+  pub_.add("trackstep",  trackStep_      ).pref();
+  pub_.add("sweepsecs",  [=]{ return telemetry().ch[0].sweepSecs; }).digits(3);
+  pub_.add("sweeplost",  [=]{ return telemetry().ch[0].sweepLostWh; }).digits(3);
+  pub_.add("restoresecs",[=]{ return telemetry().ch[0].restoreSecs; }).digits(3);
+  pub_.add("warmstart",  warmStart_      ).pref();
+  pub_.add("firstadjust",[=]{ return firstAdjustMs_ / 1000.0; }); //s from boot to tracking at a known mpp
+  pub_.add("wh", [=]{ return telemetry().ch[0].wh; }, [=](String s) { ckPSUs(); psu_->wh_ = s.toFloat(); return String(psu_->wh_); });
+  pub_.add("collapses", [=]{ return telemetry().ch[0].collapses; });
+  pub_.add("sweep",[=](String s){ //all of them, or sweep=2
+    for (int i = 0; i < channels_; i++) if (ch_[i].psu_ && (!s.toInt() || s.toInt() == i + 1)) startSweep(ch_[i]);
+    return "starting sweep";
+  }).hide();
+  pub_.add("connect",[=](String s){ doConnect(); return "connected"; }).hide().local(); //the publish task owns the network
+  pub_.add("disconnect",[=](String s){ db_.client.disconnect(); WiFi.disconnect(); return "dissed"; }).hide().local();
   pub_.add("restart",[](String s){ ESP.restart(); return ""; }).hide();
   pub_.add("clear",[=](String s){ pub_.clearPrefs(); return "cleared"; }).hide();
   pub_.add("debug",[=](String s){ ckPSUs(); psu_->debug_ = !(s == "off"); return String(psu_->debug_); }).hide();
+  pub_.add("psupipe",[=](String s){
+    if (!s.length()) { Settings st = settings(); return String(!st.drok? "no drok psu" : st.psuPipe? "on" : "off"); }
+    ckDrok();
+    drok->pipeline_ = (s == "on");
+    snapshotSettings();
+    return String(drok->pipeline_? "on" : "off");
+  }).pref();
+  pub_.add("psustats",[=](String s){ ckPSUs(); String ret = psu_->getStats(); log(ret); return ret; }).hide();
   pub_.add("version",[=](String){ log("Version " + version_); return version_; }).hide();
   pub_.add("update",[=](String s){ doOTAUpdate_ = s; return "OK, will try "+s; }).hide();
+  pub_.add("adcstats",[=](String){ return str("%u samples, %0.3fV mean noise, %dms x%d oversampled", ch_[0].adc_.samples(), ch_[0].adc_.noise() * vadjust_ / 4096.0, ch_[0].adc_.periodMs_, ch_[0].adc_.oversample_); }).hide();
+  pub_.add("schedstats",[=](String){ FixedStr<512> s; sched_.print(s); return String(s.c_str()); }).hide();
+  pub_.add("latstats",[=](String){ FixedStr<512> s; for (auto &h : lat_) { h.print(s); s.cat("\n"); } return String(s.c_str()); }).hide();
+  pub_.add("latreset",[=](String){ for (auto &h : lat_) h.reset(); return "latency stats reset"; }).hide();
+  for (int i = 0; i < Stages::count; i++) { //us, refreshed once a minute
+    pub_.add(str("%sp99", lat_[i].name_), [=]{ return lat_[i].percentile(0.99); });
+    latPubs_.set(pub_.id(str("%sp99", lat_[i].name_)));
+  }
+  pub_.add("histstats",[=](String){ return str("%u samples, %u held over %0.1fh in %u bytes (%0.1f bits each), %u skipped",
+      history_.samples_, history_.held(), history_.spanMs() / 3.6e6, history_.bytes(), history_.held()? history_.bytes() * 8.0 / history_.held() : 0, history_.skipped_); }).hide();
+  pub_.add("spillperiod",spillPeriod_   ).pref();
+  pub_.add("spillrate",  spillRate_      ).pref();
+  pub_.add("spillstats",[=](String){ return str("%u spilled, %u replayed, %u dropped, %u pending, %u sector erases of %uKB",
+      spill_.appended_, spill_.replayed_, spill_.dropped_, spill_.pending(), spill_.erases_, spill_.regionBytes() / 1024); }).hide();
+  pub_.add("pubstats",[=](String){ return str("%u msgs published, %u values needed the heap, %u updates coalesced", pub_.published_, pub_.fallbacks_, pub_.coalesced_); }).hide();
+  pub_.add("eventperiod",eventPeriod_    ).pref();
   pub_.add("uptime",[=](String){ String ret = "Uptime " + timeAgo(millis()/1000); log(ret); return ret; }).hide();
 
   server_.on("/", HTTP_ANY, [=]() {
-    log("got req " + server_.uri() + " -> " + server_.hostHeader());
+    logFmt("got req %s -> %s", server_.uri(), server_.hostHeader());
     String ret;
     for (int i = 0; i < server_.args(); i++)
       ret += pub_.handleSet(server_.argName(i), server_.arg(i)) + "\n";
     server_.sendHeader("Connection", "close");
-    if (! ret.length()) ret = pub_.toJson();
-    server_.send(200, "application/json", ret.c_str());
+    if (ret.length()) return server_.send(200, "application/json", ret.c_str());
+    FixedStr<24> etag;
+    etag.add("\"%08x-%u\"", etagSalt_, pub_.docVersion());
+    server_.sendHeader("ETag", etag.c_str());
+    server_.sendHeader("Cache-Control", "no-cache"); //always revalidate, it's cheap
+    if (server_.header("If-None-Match") == etag.c_str()) return server_.send(304);
+    server_.setContentLength(CONTENT_LENGTH_UNKNOWN); //chunked, no whole-document String
+    server_.send(200, "application/json", "");
+    pub_.streamJson([this](const char *s, size_t l) { server_.sendContent(s, l); });
+    server_.sendContent("");
+  });
+
+  server_.on("/events", HTTP_GET, [=]() { //server-sent events, {"key":value,...} of what changed every eventperiod ms
+    if (events_.size() >= SOLAR_MAX_EVENT_STREAMS) {
+      server_.sendHeader("Connection", "close");
+      return server_.send(503, "text/plain", "too many event streams");
+    }
+    events_.push_back({server_.client(), //kept open after the handler returns, our copy holds the socket
+        "HTTP/1.1 200 OK\r\nContent-Type: text/event-stream\r\nCache-Control: no-cache\r\n"
+        "Access-Control-Allow-Origin: *\r\nConnection: keep-alive\r\n\r\nretry: 2000\n\n"});
+    logFmt("events stream %d opened", events_.size());
+  });
+  static const char *collect[] = {"If-None-Match"};
+  server_.collectHeaders(collect, 1);
+
+  server_.on("/stats", HTTP_GET, [=]() { //per stage latency, /stats?reset clears after reading
+    FixedStr<1024> s;
+    s.cat("{");
+    for (int i = 0; i < Stages::count; i++) {
+      s.cat(i? ",\n  " : "\n  ");
+      lat_[i].json(s);
+    }
+    s.cat("\n}\n");
+    if (server_.hasArg("reset")) for (auto &h : lat_) h.reset();
+    server_.sendHeader("Connection", "close");
+    server_.send(200, "application/json", s.c_str());
+  });
+
+  server_.on("/history", HTTP_GET, [=]() { //binary, see History::dump. ?from=&to= device millis, or ?secs= back from now
+    uint32_t now = millis(), from = now - INT32_MAX, to = now;
+    if (server_.hasArg("secs")) from = now - server_.arg("secs").toInt() * 1000;
+    if (server_.hasArg("from")) from = strtoul(server_.arg("from").c_str(), NULL, 10);
+    if (server_.hasArg("to")) to = strtoul(server_.arg("to").c_str(), NULL, 10);
+    server_.sendHeader("Connection", "close");
+    server_.setContentLength(CONTENT_LENGTH_UNKNOWN);
+    server_.send(200, "application/octet-stream", "");
+    history_.dump(from, to, [this](const char *s, size_t l) { server_.sendContent(s, l); });
+    server_.sendContent("");
   });
 
   server_.on("/update", HTTP_GET, [this](){
@@ -113,71 +235,136 @@ void Solar::setup() {
   },[=](){
     HTTPUpload& upload = server_.upload();
     if (upload.status == UPLOAD_FILE_START){
-      log(str("Update: %s\n", upload.filename.c_str()));
+      logFmt("Update: %s\n", upload.filename.c_str());
       doOTAUpdate_ = " "; //stops tasks
       db_.client.disconnect(); //helps reliability
       esp_task_wdt_init(120, true); //slows watchdog
       if (!Update.begin(UPDATE_SIZE_UNKNOWN))//start with max available size
         Update.printError(Serial);
     } else if (upload.status == UPLOAD_FILE_WRITE){
-      log(str("OTA upload at %dKB ~%0.1f%%", Update.progress() / 1000, Update.progress() * 100.0 / (float)espSketchSize_));
+      logFmt("OTA upload at %dKB ~%0.1f%%", Update.progress() / 1000, Update.progress() * 100.0 / (float)espSketchSize_);
       if (Update.write(upload.buf, upload.currentSize) != upload.currentSize)
         Update.printError(Serial);
     } else if(upload.status == UPLOAD_FILE_END){
       if (Update.end(true))
-        log(str("Update Success: %u\nRebooting...\n", upload.totalSize));
+        logFmt("Update Success: %u\nRebooting...\n", upload.totalSize);
       else Update.printError(Serial);
     } else if (upload.status == UPLOAD_FILE_ABORTED){
       log("Update ABORTED, rebooting.");
       Update.abort();
       delay(500);
       ESP.restart();
-    } else log(str("Update ELSE %d", upload.status));
+    } else logFmt("Update ELSE %d", upload.status);
   });
 
   pub_.loadPrefs();
   // wifi & mqtt is connected by pubsubConnect below
+  if (spill_.begin())
+    logFmt("spill log: %u records pending from earlier, %uKB of flash", spill_.pending(), spill_.regionBytes() / 1024);
+  else log("no spiffs partition, nothing is kept while offline");
 
-  if (digitalPinToAnalogChannel(pinInvolt_) < 0)
-    log(str("ERROR, inPin %d isn't actually an ADC pin", pinInvolt_));
-  if (digitalPinToAnalogChannel(pinInvolt_) > 7)
-    log(str("ERROR, inPin %d is an ADC2 pin and WILL NOT WORK", pinInvolt_));
+  for (int i = 1; i < channels_; i++) addChannelPubs(ch_[i]); //added at runtime they'd race the publish task
+  if (channels_ > 1) {
+    pub_.add("bankcurr", [=]{ return telemetry().bankCurr(); });
+    pub_.add("bankpower",[=]{ return telemetry().bankPower(); });
+    logFmt("%d channels, %0.1fA cap each, %0.1fA for the bank", channels_, currentCap_, bankCap_);
+  }
+  for (int i = 0; i < channels_; i++) channelPubIds(ch_[i]);
+  for (int i = 1; i < channels_; i++) //until its first sweep, a string starts where the first is
+    if (!ch_[i].setpoint_) ch_[i].setpoint_ = ch_[0].setpoint_;
 
-  //fn, name, stack size, parameter, priority, handle
-  xTaskCreate(runPubt, "publish", 10000, this, 1, NULL);
+  for (int i = 0; i < channels_; i++) {
+    Channel &c = ch_[i];
+    if (digitalPinToAnalogChannel(c.pinInvolt_) < 0)
+      logFmt("ERROR, inPin%s %d isn't actually an ADC pin", c.suffix(), c.pinInvolt_);
+    if (digitalPinToAnalogChannel(c.pinInvolt_) > 7)
+      logFmt("ERROR, inPin%s %d is an ADC2 pin and WILL NOT WORK", c.suffix(), c.pinInvolt_);
+  }
+
+  //fn, name, stack size, parameter, priority, handle, core. wifi lives on core 0, so does the network side
+  xTaskCreatePinnedToCore(runPubt, "publish", 10000, this, 1, NULL, 0);
 
-  if (!psu_) log("no PSU set");
-  else if (!psu_->begin()) log("PSU begin failed");
-  else if (psu_) {
-    psu_->currFilt_ = psu_->limitCurr_ = psu_->outCurr_;
-    log(str("startup current is %0.3fAfilt/%0.3fAout", psu_->currFilt_, psu_->outCurr_));
+  warmBooted_ = true;
+  for (int i = 0; i < channels_; i++) {
+    Channel &c = ch_[i];
+    if (!c.psu_) logFmt("%sno PSU set", c.tag_);
+    else if (!c.psu_->begin()) logFmt("%sPSU begin failed", c.tag_);
+    else {
+      c.psu_->currFilt_ = c.psu_->limitCurr_ = c.psu_->outCurr_;
+      logFmt("%sstartup current is %0.3fAfilt/%0.3fAout", c.tag_, c.psu_->currFilt_, c.psu_->outCurr_);
+    }
+    bool warm = warmStart_ && warmStart(c);
+    if (!warm) sweepAt(c, millis() + 10000); //cold, find the mpp first
+    warmBooted_ &= warm;
   }
-  if (autoSweep_ > 0) nextAutoSweep_ = millis() + 10000;
-  log("finished setup");
+  snapshot();
+  snapshotSettings();
+  pub_.runner_ = [this](const StrFn &fn) { return onControl(fn); };
+  log("finished setup"); //before the control task starts, this task and it would share one single-producer ring
   log("OSPController Version " + version_);
+  xTaskCreatePinnedToCore(runControl, "control", 8000, this, 3, NULL, 1); //above the arduino loop and the adc
 }
 
 String Solar::setLVProtect(String s) {
   if (s.length()) {
     lvProtect_.reset(new LowVoltageProtect(s)); //may throw!
     log("low-voltage cutoff enabled: " + lvProtect_->toString() + " (pin[i]:cutoff:recovery)");
-    lvProtect_->nextCheck_ = millis() + 5000; //don't check right away
+    sched_.after(lvJob_, 5000); //don't check right away
+    snapshotSettings();
     return "new " + lvProtect_->toString() + " ok";
   } else return lvProtect_? lvProtect_->toString() : "";
 }
 
-String Solar::setPSU(String s) {
-  if (s.length() || !psu_) {
-    log("setPSU " + s);
-    //TODO Parse softserial pins, bluetooth comms, and moar.
-    psu_.reset(PowerSupply::make(s));
-    if (psu_ && ! psu_->isDrok() && (measperiod_ == 200)) //default
-      measperiod_ = 500; //slow down, DSP5005 meas does full update()
-    ckPSUs();
-    psu_->begin();
-    return "created psu " + psu_->getType();
+String Solar::setPSU(Channel &c, String s) {
+  if (!s.length()) return c.psu_? c.psu_->getType() : String(); //a read, an unpopulated channel stays that way
+  logFmt("%ssetPSU %s", c.tag_, s);
+  //TODO bluetooth comms, and moar.
+  std::vector<Stream*> taken; //the other strings' uarts
+  for (int i = 0; i < channels_; i++) if (&ch_[i] != &c && ch_[i].psu_) taken.push_back(ch_[i].psu_->port_);
+  c.psu_.reset(); //ends its uart before the new one begins it
+  snapshotSettings(); //if make() throws it stays gone
+  c.psu_.reset(PowerSupply::make(s, taken)); //may throw!
+  if (!c.psu_) return String("no psu");
+  c.psu_->log_ = &pub_;
+  c.psu_->begin();
+  if (c.n_ >= channels_) { //a new string
+    channels_ = c.n_ + 1;
+    for (int i = 0; i < channels_; i++) snprintf(ch_[i].tag_, sizeof(ch_[i].tag_), "[%d] ", i + 1);
+    sweepAt(c, millis() + 10000);
+    if (!c.setpoint_) c.setpoint_ = ch_[0].setpoint_;
   }
-  return psu_->getType();
+  snapshotSettings();
+  return "created psu " + c.psu_->getType();
+}
+
+void Solar::addChannelPubs(Channel &c) { //telemetry, the tuning is shared
+  int i = c.n_;
+  String n = c.suffix();
+  pub_.add("involt" + n,   [=]{ return telemetry().ch[i].inVolt; });
+  pub_.add("outputEN" + n, [=]{ return telemetry().ch[i].outEn; });
+  pub_.add("outvolt" + n,  [=]{ return telemetry().ch[i].outVolt; });
+  pub_.add("outcurr" + n,  [=]{ return telemetry().ch[i].outCurr; });
+  pub_.add("outpower" + n, [=]{ Telemetry t = telemetry(); return t.ch[i].outVolt * t.ch[i].outCurr; });
+  pub_.add("state" + n,    [=](String){ return String(telemetry().ch[i].state); });
+  pub_.add("setpoint" + n, [=]{ return telemetry().ch[i].setpoint; });
+  pub_.add("wh" + n,       [=]{ return telemetry().ch[i].wh; });
+  pub_.add("collapses" + n,[=]{ return telemetry().ch[i].collapses; });
+  pub_.add("sweepsecs" + n, [=]{ return telemetry().ch[i].sweepSecs; }).digits(3);
+}
+
+void Solar::channelPubIds(Channel &c) { //ids that aren't registered are NO_PUB, and ignored
+  String n = c.suffix();
+  for (auto k : {"outvolt", "outcurr", "outputEN", "outpower", "currFilt"}) c.psuPubs_.set(pub_.id(k + n));
+  for (auto k : {"bankcurr", "bankpower"}) c.psuPubs_.set(pub_.id(k));
+  for (auto k : {"outcurr", "outpower"}) c.adjustPubs_.set(pub_.id(k + n));
+  for (auto k : {"sweepsecs", "sweeplost"}) c.sweepPubs_.set(pub_.id(k + n));
+  c.whPub_ = pub_.id("wh" + n);
+  c.collapsesPub_ = pub_.id("collapses" + n);
+  c.statePub_ = pub_.id("state" + n);
+  c.setpointPub_ = pub_.id("setpoint" + n);
+  c.involtPub_ = pub_.id("involt" + n);
+  c.restorePub_ = pub_.id("restoresecs" + n);
+  c.offPub_ = pub_.id("offthreshold" + n);
 }
 
 void Solar::doConnect() {
@@ -203,324 +390,727 @@ void Solar::doConnect() {
         log("PubSub connect success! " + db_.client.state());
         db_.client.subscribe((db_.feed + "/cmd").c_str()); //subscribe to cmd topic for any actions
         lastConnected_ = millis();
-      } else pub_.logNote("[PubSub connect ERROR]" + db_.client.state());
+      } else pub_.logNote("[PubSub connect ERROR %d]", db_.client.state());
     } else pub_.logNote("[no MQTT user/pass/serv/feed set up]");
-  } else pub_.logNote(str("[can't pub connect, wifi %d pub %d]", WiFi.isConnected(), db_.client.connected()));
+  } else pub_.logNote("[can't pub connect, wifi %d pub %d]", WiFi.isConnected(), db_.client.connected());
 }
 
 String SPoint::toString() const {
   return str("[%0.2fVin %0.2fVout %0.2fAout", input, v, i) + (collapsed? " CLPS]" : " ]");
 }
 
-void Solar::applyAdjustment(float current) {
-  if (psu_ && current != psu_->limitCurr_) {
-    if (psu_->setCurrent(current))
-      pub_.logNote(str("[adjusting %0.3fA (from %0.3fA)]", current - psu_->limitCurr_, psu_->limitCurr_));
-    else log("error setting current");
-    delay(50);
-    psu_->readCurrent();
-    pub_.setDirty({"outcurr", "outpower"});
-    printStatus();
+void Solar::applyAdjustment(Channel &c, float current) {
+  if (c.psu_ && current != c.psu_->limitCurr_) {
+    float was = c.psu_->limitCurr_; //setCurrent overwrites it
+    if (c.psu_->setCurrent(current))
+      pub_.logNote("[adjusting %0.3fA (from %0.3fA)]", current - was, was);
+    else logFmt("%serror setting current", c.tag_);
+    if (!c.psu_->isAsync()) delay(50); //async reads queue up behind the set anyway
+    c.psu_->readCurrent();
+    pub_.setDirty(c.adjustPubs_);
+    printStatus(c);
   }
 }
 
-void Solar::startSweep() {
-  if (state_ == States::error)
-    return log("can't sweep, system is in error state");
-  psu_->setCurrent(psu_->currFilt_* 0.90); //back off a little to start
-  log(str("SWEEP START c=%0.3f, (setpoint was %0.3f)", psu_->limitCurr_, setpoint_));
-  if ((psu_ && state_ == States::collapsemode) || hasCollapsed()) {
-    log(str("First coming out of collapse-mode to clim of %0.2fA", psu_->limitCurr_));
-    restoreFromCollapse(psu_->currFilt_* 0.75);
+void Solar::startSweep(Channel &c) {
+  if (!c.psu_) return; //an unpopulated channel, nothing to sweep
+  if (c.state_ == States::error)
+    return logFmt("%scan't sweep, system is in error state", c.tag_);
+  if (c.restoring())
+    return logFmt("%scan't sweep, restoring from a collapse", c.tag_);
+  c.sweepStart_ = millis();
+  c.sweepStartWh_ = c.psu_->wh_;
+  c.psu_->setCurrent(c.psu_->currFilt_* 0.90); //back off a little to start
+  logFmt("%sSWEEP START %s c=%0.3f, (setpoint was %0.3f)", c.tag_, sweepMode_, c.psu_->limitCurr_, c.setpoint_);
+  c.sweepPoints_.clear();
+  c.tracker_->reset();
+  c.golden_ = GoldenSweep();
+  c.golden_.step = max(0.05, c.psu_->limitCurr_ * 0.02);
+  c.golden_.settle = c.psu_->isAsync()? 1 : 0; //the first probe reads after the back-off lands
+  if ((c.psu_ && c.state_ == States::collapsemode) || hasCollapsed(c)) {
+    logFmt("%sFirst coming out of collapse-mode to clim of %0.2fA", c.tag_, c.psu_->limitCurr_);
+    restoreFromCollapse(c, c.psu_->currFilt_* 0.75);
   }
-  setState(States::sweeping);
-  if (psu_ && !psu_->outEn_)
-      psu_->enableOutput(true);
-  lastAutoSweep_ = millis();
+  setState(c, States::sweeping);
+  if (c.psu_ && !c.psu_->outEn_)
+      c.psu_->enableOutput(true);
+  c.lastAutoSweep_ = millis();
 }
 
-void Solar::doSweepStep() {
-  if (!psu_) return;
-  if (!psu_->outEn_)
-    return setState(States::mppt);
+void Solar::doSweepStep(Channel &c) {
+  if (!c.psu_) return;
+  if (!c.psu_->outEn_)
+    return setState(c, States::mppt);
 
-  updatePSU();
+  updatePSU(c);
+  if (sweepMode_ == "golden")
+    return doGoldenStep(c);
 
-  bool isCollapsed = hasCollapsed();
-  sweepPoints_.push_back({v: psu_->outVolt_, i: psu_->outCurr_, input: inVolt_, collapsed: isCollapsed});
+  bool isCollapsed = hasCollapsed(c);
+  c.sweepPoints_.push_back({v: c.psu_->outVolt_, i: c.psu_->outCurr_, input: c.inVolt_, collapsed: isCollapsed});
   int collapsedPoints = 0, nonCollapsedPoints = 0;
-  for (int i = 0; i < sweepPoints_.size(); i++) {
-    if (sweepPoints_[i].collapsed) collapsedPoints++;
+  for (int i = 0; i < c.sweepPoints_.size(); i++) {
+    if (c.sweepPoints_[i].collapsed) collapsedPoints++;
     else nonCollapsedPoints++;
   }
-  if (isCollapsed) pub_.logNote(str("COLLAPSED[%d]", collapsedPoints));
+  if (isCollapsed) pub_.logNote("COLLAPSED[%d]", collapsedPoints);
 
   if (isCollapsed && collapsedPoints >= 2) { //great, sweep finished
     if (!nonCollapsedPoints) {
-      log("SWEEP DONE but zero un-collapsed points. aborting.");
-      restoreFromCollapse(psu_->currFilt_* 0.5);
-      return setState(States::mppt);
+      logFmt("%sSWEEP DONE but zero un-collapsed points. aborting.", c.tag_);
+      endSweep(c, c.sweepPoints_.back().p());
+      restoreFromCollapse(c, c.psu_->currFilt_* 0.5);
+      return setState(c, States::mppt);
     }
     int maxIndex = 0;
-    SPoint collapsePoint = sweepPoints_.back();
+    SPoint collapsePoint = c.sweepPoints_.back();
 
-    for (int i = 0; i < sweepPoints_.size(); i++) {
-      log(str("point %i = ", i) + sweepPoints_[i].toString());
-      if (!sweepPoints_[i].collapsed && sweepPoints_[i].p() > sweepPoints_[maxIndex].p())
+    for (int i = 0; i < c.sweepPoints_.size(); i++) {
+      logFmt("%spoint %i = %s", c.tag_, i, c.sweepPoints_[i].toString());
+      if (!c.sweepPoints_[i].collapsed && c.sweepPoints_[i].p() > c.sweepPoints_[maxIndex].p())
         maxIndex = i; //find max
     }
-    String tolog = "SWEEP DONE. max = " + sweepPoints_[maxIndex].toString();
-    if (sweepPoints_[maxIndex].p() < collapsePoint.p()) {
-      log(tolog + str(" will run collapsed! (next sweep in %0.1fm)", ((float)autoSweep_) / 3.0 / 60.0));
-      setState(States::collapsemode);
-      psu_->setCurrent(currentCap_ > 0? currentCap_ : 10);
-      nextAutoSweep_ = millis() + autoSweep_ * 1000 / 3; //reschedule soon
-      setpoint_ = collapsePoint.input;
+    String tolog = "SWEEP DONE. max = " + c.sweepPoints_[maxIndex].toString();
+    endSweep(c, max(c.sweepPoints_[maxIndex].p(), collapsePoint.p()));
+    if (c.sweepPoints_[maxIndex].p() < collapsePoint.p()) {
+      logFmt("%s will run collapsed! (next sweep in %0.1fm)", tolog, ((float)autoSweep_) / 3.0 / 60.0);
+      setState(c, States::collapsemode);
+      c.psu_->setCurrent(capFor(c) > 0? capFor(c) : 10);
+      sweepAt(c, millis() + autoSweep_ * 1000 / 3); //reschedule soon
+      c.setpoint_ = collapsePoint.input;
     } else {
       maxIndex = max(0, maxIndex - 2);
-      log(tolog + str(" new setpoint = %0.3f (was %0.3f)", sweepPoints_[maxIndex].input, setpoint_));
-      setState(States::mppt);
-      restoreFromCollapse(sweepPoints_[maxIndex].i * (0.98 - 0.04 * min(getCollapses(), 8))); //more collapses, more backoff
-      setpoint_ = sweepPoints_[maxIndex].input;
+      logFmt("%s new setpoint = %0.3f (was %0.3f)", tolog, c.sweepPoints_[maxIndex].input, c.setpoint_);
+      setState(c, States::mppt);
+      restoreFromCollapse(c, c.sweepPoints_[maxIndex].i * (0.98 - 0.04 * min(c.getCollapses(), 8))); //more collapses, more backoff
+      c.setpoint_ = c.sweepPoints_[maxIndex].input;
     }
-    pub_.setDirtyAddr(&setpoint_);
-    nextSolarAdjust_ = millis() + 1000; //don't recheck the voltage too quickly
-    sweepPoints_.clear();
-    //the output should be re-enabled below
+    pub_.setDirty(c.setpointPub_);
+    adjustAfter(c, 1000); //don't recheck the voltage too quickly
+    c.sweepPoints_.clear();
+    return; //sweep is over, the checks below would read the cleared points
   }
 
-  if (psu_->limitCurr_ >= currentCap_) {
-    setpoint_ = inVolt_ - (pgain_ * 4);
-    setpoint_ = sweepPoints_.back().input;
-    setState(States::mppt);
-    log(str("SWEEP DONE, currentcap of %0.1fA reached (setpoint=%0.3f)", currentCap_, setpoint_));
-    return applyAdjustment(currentCap_);
-  } else if (psu_->isCV()) {
-    setState(States::full_cv);
-    return log("SWEEP DONE, constant-voltage state reached");
+  float cap = capFor(c);
+  if (c.psu_->limitCurr_ >= cap) {
+    c.setpoint_ = c.inVolt_ - (pgain_ * 4);
+    c.setpoint_ = c.sweepPoints_.back().input;
+    pub_.setDirty(c.setpointPub_);
+    setState(c, States::mppt);
+    logFmt("%sSWEEP DONE, currentcap of %0.1fA reached (setpoint=%0.3f)", c.tag_, cap, c.setpoint_);
+    endSweep(c, c.sweepPoints_.back().p());
+    return applyAdjustment(c, cap);
+  } else if (c.psu_->isCV()) {
+    setState(c, States::full_cv);
+    logFmt("%sSWEEP DONE, constant-voltage state reached", c.tag_);
+    return endSweep(c, c.sweepPoints_.back().p());
   }
 
-  applyAdjustment(min(psu_->limitCurr_ + (inVolt_ * 0.001), currentCap_ + 0.001)); //speed porportional to input voltage
+  applyAdjustment(c, min(c.psu_->limitCurr_ + (c.inVolt_ * 0.001), cap + 0.001)); //speed porportional to input voltage
 }
 
-bool Solar::hasCollapsed() const {
-  if (!psu_ || !psu_->outEn_) return false;
-  if (!psu_->isDrok() && psu_->isCollapsed()) //DP* psu is darn accurate
+//power vs current limit rises until the panel collapses, then drops. double the
+//step until it stops rising, then golden-section the last bracket down to ~tol
+void Solar::doGoldenStep(Channel &c) {
+  static const float R = 0.618034;
+  GoldenSweep &g = c.golden_;
+  if (g.settle && g.settle--) return;
+  SPoint pt = {v: c.psu_->outVolt_, i: c.psu_->outCurr_, input: c.inVolt_, collapsed: hasCollapsed(c)};
+  float probe = c.psu_->limitCurr_;
+  if (pt.collapsed) {
+    pub_.logNote("COLLAPSED[%0.2fA]", probe);
+    if (pt.p() > g.bestClps.p()) g.bestClps = pt;
+  } else if (pt.p() > g.best.p()) g.best = pt;
+
+  float next = 0, cap = capFor(c);
+  if (g.phase == 0) { //bracketing
+    bool falling = pt.collapsed || (g.prevLimit > 0 && pt.p() < g.prev.p());
+    if (!falling && probe >= cap) {
+      c.setpoint_ = pt.input;
+      pub_.setDirty(c.setpointPub_);
+      setState(c, States::mppt);
+      logFmt("%sSWEEP DONE, currentcap of %0.1fA reached (setpoint=%0.3f)", c.tag_, cap, c.setpoint_);
+      endSweep(c, pt.p());
+      return applyAdjustment(c, cap);
+    } else if (!falling && c.psu_->isCV()) {
+      setState(c, States::full_cv);
+      logFmt("%sSWEEP DONE, constant-voltage state reached", c.tag_);
+      return endSweep(c, pt.p());
+    } else if (!falling) {
+      g.prev2 = g.prev;
+      g.prev2Limit = g.prevLimit;
+      g.prev = pt;
+      g.prevLimit = probe;
+      next = min(probe + g.step, cap);
+      g.step *= 2;
+    } else {
+      if (pt.collapsed && g.prevLimit > 0) g.a = g.prevLimit; //the prev probe held, the cliff is above it
+      else g.a = (g.prev2Limit > 0)? g.prev2Limit : (g.prevLimit > 0)? g.prevLimit : probe * 0.8;
+      g.b = probe;
+      g.c = next = g.b - R * (g.b - g.a);
+      g.d = g.a + R * (g.b - g.a);
+      g.phase = 1;
+    }
+  } else {
+    if (g.phase == 1) g.pc = pt.p();
+    else g.pd = pt.p();
+    if (g.phase == 1 && g.pd == 0) { //first pass needs both
+      next = g.d;
+      g.phase = 2;
+    } else if (g.pc >= g.pd) {
+      g.b = g.d; g.d = g.c; g.pd = g.pc;
+      g.c = next = g.b - R * (g.b - g.a);
+      g.phase = 1;
+    } else {
+      g.a = g.c; g.c = g.d; g.pc = g.pd;
+      g.d = next = g.a + R * (g.b - g.a);
+      g.phase = 2;
+    }
+    if ((g.b - g.a) < max(0.05, g.b * 0.02)) { //converged
+      if (g.best.i <= 0) {
+        logFmt("%sSWEEP DONE but zero un-collapsed points. aborting.", c.tag_);
+        endSweep(c, g.bestClps.p());
+        restoreFromCollapse(c, c.psu_->currFilt_* 0.5);
+        return setState(c, States::mppt);
+      }
+      endSweep(c, max(g.best.p(), g.bestClps.p()));
+      if (g.best.p() < g.bestClps.p()) {
+        logFmt("%sSWEEP DONE. max = %s will run collapsed! (next sweep in %0.1fm)", c.tag_, g.bestClps.toString(), ((float)autoSweep_) / 3.0 / 60.0);
+        setState(c, States::collapsemode);
+        c.psu_->setCurrent(capFor(c) > 0? capFor(c) : 10);
+        sweepAt(c, millis() + autoSweep_ * 1000 / 3); //reschedule soon
+        c.setpoint_ = g.bestClps.input;
+      } else {
+        float setpoint = g.best.input * 1.005; //a hair up the voltage side, like linear's two points back
+        logFmt("%sSWEEP DONE. max = %s new setpoint = %0.3f (was %0.3f)", c.tag_, g.best.toString(), setpoint, c.setpoint_);
+        setState(c, States::mppt);
+        float current = g.best.i * (0.98 - 0.04 * min(c.getCollapses(), 8)); //more collapses, more backoff
+        if (pt.collapsed) restoreFromCollapse(c, current);
+        else applyAdjustment(c, current);
+        c.setpoint_ = setpoint;
+      }
+      pub_.setDirty(c.setpointPub_);
+      adjustAfter(c, 1000); //don't recheck the voltage too quickly
+      return;
+    }
+  }
+  if (pt.collapsed) restoreFromCollapse(c, next); //collapsed probes have to recover before the next
+  else applyAdjustment(c, next);
+  g.settle = c.psu_->isAsync()? 1 : 0; //async reads can still be from before the set
+}
+
+void Solar::endSweep(Channel &c, double bestPower) {
+  c.sweepSecs_ = (millis() - c.sweepStart_) / 1000.0;
+  c.sweepLostWh_ = max(0.0, bestPower * c.sweepSecs_ / 3600.0 - (c.psu_->wh_ - c.sweepStartWh_));
+  logFmt("%sSWEEP took %0.1fs, %0.3fWh short of running at %0.1fW throughout", c.tag_, c.sweepSecs_, c.sweepLostWh_, bestPower);
+  pub_.setDirty(c.sweepPubs_);
+  atMpp_ = true;
+}
+
+bool Solar::hasCollapsed(const Channel &c) const {
+  if (!c.psu_ || !c.psu_->outEn_) return false;
+  if (!c.psu_->isDrok() && c.psu_->isCollapsed()) //DP* psu is darn accurate
     return true;
-  bool simpleClps = (inVolt_ < (psu_->outVolt_ * 1.11)); //simple voltage match method
-  float collapsePct = (inVolt_ - psu_->outVolt_) / psu_->outVolt_;
-  if (simpleClps && psu_->isCollapsed())
+  bool simpleClps = (c.inVolt_ < (c.psu_->outVolt_ * 1.11)); //simple voltage match method
+  float collapsePct = (c.inVolt_ - c.psu_->outVolt_) / c.psu_->outVolt_;
+  if (simpleClps && c.psu_->isCollapsed())
     return true;
-  if ((collapsePct < 0.05) && psu_->isCollapsed()) { //secondary method
-    log(str("hasCollapsed used secondary method. collapse %0.3f%%", collapsePct));
+  if ((collapsePct < 0.05) && c.psu_->isCollapsed()) { //secondary method
+    logFmt("%shasCollapsed used secondary method. collapse %0.3f%%", c.tag_, collapsePct);
     return true;
   }
   return false;
 }
 
-int Solar::getCollapses() const { return collapses_.size(); }
-
-bool Solar::updatePSU() {
+bool Solar::updatePSU(Channel &c) {
+  StageTimer t(lat_[Stages::psu]);
   uint32_t start = millis();
-  if (psu_ && psu_->doUpdate()) {
-    pub_.setDirty({"outvolt", "outcurr", "outputEN", "outpower", "currFilt"});
-    if (psu_->wh_ > 2.0 || (millis() - lastConnected_) > 60000)
-      pub_.setDirty("wh"); //don't publish for a while after reboot
-    if (psu_->debug_) log(psu_->getType() + str(" updated in %d ms: ", millis() - start) + psu_->toString());
+  if (c.psu_ && c.psu_->doUpdate()) {
+    pub_.setDirty(c.psuPubs_);
+    if (c.psu_->wh_ > 2.0 || (millis() - lastConnected_) > 60000)
+      pub_.setDirty(c.whPub_);
+    else pub_.setStale(c.whPub_); //don't publish for a while after reboot, the retained value may restore it
+    if (c.psu_->debug_) logFmt("%s updated in %d ms: %s", c.psu_->getType(), millis() - start, c.psu_->toString());
     return true;
   }
   return false;
 }
 
-float Solar::measureInvolt() {
-  if (psu_ && psu_->getInputVolt(&inVolt_)) {
+float Solar::measureInvolt(Channel &c) {
+  if (c.psu_ && c.psu_->getInputVolt(&c.inVolt_)) {
     //excellent, we could read the input voltage! nothing else required
-    if ((millis() - psu_->lastSuccess_) > 600) {
-      updatePSU(); //seems to take ~400ms for a DP
-      psu_->getInputVolt(&inVolt_);
+    if ((millis() - c.psu_->lastSuccess_) > (uint32_t) measperiod_ / 2) { //fresh every measurement
+      updatePSU(c); //DP fast read, ~15ms
+      c.psu_->getInputVolt(&c.inVolt_);
     }
   } else {
-    int analogval = analogRead(pinInvolt_);
-    inVolt_ = analogval * 3.3 * (vadjust_ / 3.3) / 4096.0;
+    if (!c.adc_.begun()) c.adc_.begin(); //first time we need the pin
+    c.inVolt_ = c.adc_.latest() * 3.3 * (vadjust_ / 3.3) / 4096.0;
   }
-  pub_.setDirtyAddr(&inVolt_);
-  return inVolt_;
+  pub_.setDirty(c.involtPub_);
+  return c.inVolt_;
 }
 
-void Solar::restoreFromCollapse(float restoreCurrent) {
-  psu_->setCurrent(0.01); //some PSU's don't disable without crashing (cough5020cough)
-  uint32_t start = millis();
-  while ((millis() - start) < 8000 && measureInvolt() < offThreshold_)
-    delay(25);
-  float in = measureInvolt();
-  if (offThreshold_ >= 1000) { //startup condition
-    offThreshold_ = 0.992 * in;
-    log(str("restore threshold now set to %0.2fV", offThreshold_));
-    pub_.setDirtyAddr(&offThreshold_);
-  }
-  log(str("restore took %0.1fs to reach %0.1fV [goal %0.1f], setting %0.1fA", (millis() - start) / 1000.0, in, offThreshold_, restoreCurrent));
-  psu_->setCurrent(restoreCurrent);
-}
-
-float Solar::doMeasure() {
-  measureInvolt();
-  if (state_ == States::sweeping) {
-    doSweepStep();
-  } else if (setpoint_ > 0 && psu_ && psu_->outEn_) { //corrections enabled
-    double error = inVolt_ - setpoint_;
-    double dcurr = constrain(error * pgain_, -ramplimit_ * 2, ramplimit_); //limit ramping speed
-    if (error > 0.3 || (-error > 0.2)) { //adjustment deadband, more sensitive when needing to ramp down
-      if ((error < 0.6) && (state_ == States::mppt)) { //ramp down, quick!
-        pub_.logNote("[QUICK]");
-        nextSolarAdjust_ = millis();
-      }
-      return min(psu_->limitCurr_ + dcurr, currentCap_);
-    }
+void Solar::restoreFromCollapse(Channel &c, float restoreCurrent, float then) {
+  c.psu_->setCurrent(0.01); //some PSU's don't disable without crashing (cough5020cough)
+  uint32_t now = millis();
+  c.restore_.start = now;
+  c.restore_.nextCheck = now; //first look straight away, as the blocking loop did
+  c.restore_.current = restoreCurrent;
+  c.restore_.then = then;
+  c.restore_.adjustIn = -1;
+  c.restore_.active = true;
+}
+
+void Solar::doRestoreStep(Channel &c) {
+  uint32_t now = millis();
+  if ((int32_t)(now - c.restore_.nextCheck) < 0) return;
+  c.restore_.nextCheck = now + 25;
+  float in = measureInvolt(c);
+  if ((now - c.restore_.start) < 8000 && in < c.offThreshold_) return; //not back yet
+  if (c.offThreshold_ >= 1000) { //startup condition
+    c.offThreshold_ = 0.992 * in;
+    logFmt("%srestore threshold now set to %0.2fV", c.tag_, c.offThreshold_);
+    pub_.setDirty(c.offPub_);
   }
-  return psu_? psu_->limitCurr_ : 0;
+  c.restoreSecs_ = (now - c.restore_.start) / 1000.0;
+  logFmt("%srestore took %0.1fs to reach %0.1fV [goal %0.1f], setting %0.1fA", c.tag_, c.restoreSecs_, in, c.offThreshold_, c.restore_.current);
+  pub_.setDirty(c.restorePub_);
+  c.restore_.active = false;
+  c.psu_->setCurrent(c.restore_.current);
+  if (c.restore_.then >= 0 && c.psu_->outEn_ && c.state_ != States::collapsemode)
+    applyAdjustment(c, c.restore_.then);
+  if (c.restore_.adjustIn >= 0) sched_.after(adjustJob_, c.restore_.adjustIn);
+}
+
+void Solar::adjustAfter(Channel &c, uint32_t ms) {
+  if (c.restoring()) c.restore_.adjustIn = ms;
+  else sched_.after(adjustJob_, ms);
+}
+
+void Solar::doMeasure(Channel &c) {
+  StageTimer t(lat_[Stages::measure]);
+  measureInvolt(c);
+  if (c.state_ == States::sweeping) {
+    doSweepStep(c);
+  } else if (c.setpoint_ > 0 && c.psu_ && c.psu_->outEn_) { //corrections enabled
+    c.tracker_->sample(*this, c);
+  }
+}
+
+float Solar::track(Channel &c) {
+  if (c.setpoint_ > 0 && c.psu_ && c.psu_->outEn_ && c.state_ != States::sweeping && c.state_ != States::collapsemode)
+    return min(c.tracker_->track(*this, c), capFor(c));
+  return c.psu_? c.psu_->limitCurr_ : 0;
+}
+
+void Solar::quickAdjust() {
+  if (sched_.running() != adjustJob_) sched_.after(adjustJob_, 0); //from inside the adjust it'd just spin
 }
 
-void Solar::doUpdateState() {
-  if (!psu_) {
-    setState(States::error);
-  } else if (state_ != States::sweeping && state_ != States::collapsemode) {
-    int lastPSUsecs = (millis() - psu_->lastSuccess_) / 1000;
-    if (psu_->outEn_) {
-      if      (lastPSUsecs > 11) setState(States::error, "enabled but no PSU comms");
-      else if (psu_->outCurr_ > (currentCap_     * 0.95 )) setState(States::capped);
-      else if (psu_->isCV()) setState(States::full_cv);
-      else setState(States::mppt);
+void Solar::doUpdateState(Channel &c) {
+  if (!c.psu_) {
+    setState(c, States::error);
+  } else if (c.state_ != States::sweeping && c.state_ != States::collapsemode) {
+    int lastPSUsecs = (millis() - c.psu_->lastSuccess_) / 1000;
+    if (c.psu_->outEn_) {
+      if      (lastPSUsecs > 11) setState(c, States::error, "enabled but no PSU comms");
+      else if (c.psu_->outCurr_ > (capFor(c)    * 0.95 )) setState(c, States::capped);
+      else if (c.psu_->isCV()) setState(c, States::full_cv);
+      else setState(c, States::mppt);
     } else { //disabled
-      if ((inVolt_ > 1) && lastPSUsecs > 120) //psu active at least every 2m when shut down
-        setState(States::error, "inactive PSU");
-      else setState(States::off);
+      if ((c.inVolt_ > 1) && lastPSUsecs > 120) //psu active at least every 2m when shut down
+        setState(c, States::error, "inactive PSU");
+      else setState(c, States::off);
     }
   }
 }
 
-void Solar::doAdjust(float desired) {
+String Solar::doAdjust(Channel &c, float desired) {
+  StageTimer t(lat_[Stages::adjust]);
   uint32_t now = millis();
+  String ret;
   try {
-    if (state_ == States::error) {
-      if (psu_ && (now - psu_->lastSuccess_) < 30000) { //for 30s after failure try and shut it down
-        psu_->enableOutput(false);
-        psu_->setCurrent(0);
+    if (c.state_ == States::error) {
+      if (c.psu_ && (now - c.psu_->lastSuccess_) < 30000) { //for 30s after failure try and shut it down
+        c.psu_->enableOutput(false);
+        c.psu_->setCurrent(0);
         throw Backoff("PSU failure, disabling");
       }
-    } else if (setpoint_ > 0 && (state_ != States::sweeping)) {
-      if (hasCollapsed() && state_ != States::collapsemode) {
-        collapses_.push_back(now);
-        pub_.setDirty("collapses");
-        log(str("collapsed! %0.2fV ", inVolt_) + psu_->toString());
-        restoreFromCollapse(psu_->currFilt_ * 0.95); //restore at 90% of previous point
-      } else if (psu_ && !psu_->outEn_) { //power supply is off. let's check about turning it on
-        if (inVolt_ < psu_->outVolt_ || psu_->outVolt_ < 0.1) {
+    } else if (c.setpoint_ > 0 && (c.state_ != States::sweeping)) {
+      if (hasCollapsed(c) && c.state_ != States::collapsemode) {
+        c.collapses_.push_back(now);
+        pub_.setDirty(c.collapsesPub_);
+        if (c.getCollapses() > 2 && autoSweep_ > 0) sweepAt(c, c.lastAutoSweep_ + autoSweepIn(c));
+        logFmt("%scollapsed! %0.2fV %s", c.tag_, c.inVolt_, c.psu_->toString());
+        restoreFromCollapse(c, c.psu_->currFilt_ * 0.95, desired); //restore at 90% of previous point, then adjust as planned
+        c.tracker_->reset();
+      } else if (c.psu_ && !c.psu_->outEn_) { //power supply is off. let's check about turning it on
+        if (c.inVolt_ < c.psu_->outVolt_ || c.psu_->outVolt_ < 0.1) {
           throw Backoff("not starting up, input voltage too low (is it dark?)");
-        } else if ((psu_->outVolt_ > psu_->limitVolt_) || (psu_->outVolt_ < (psu_->limitVolt_ * 0.60) && psu_->outVolt_ > 1)) {
+        } else if ((c.psu_->outVolt_ > c.psu_->limitVolt_) || (c.psu_->outVolt_ < (c.psu_->limitVolt_ * 0.60) && c.psu_->outVolt_ > 1)) {
           //li-ion 4.1-2.5 is 60% of range. the last && condition allows system to work with battery drain diode in place
-          throw Backoff(str("not starting up, battery %0.1fV too far from Supply limit %0.1fV. ", psu_->outVolt_, psu_->limitVolt_) +
+          throw Backoff(str("not starting up, battery %0.1fV too far from Supply limit %0.1fV. ", c.psu_->outVolt_, c.psu_->limitVolt_) +
           "Use outvolt command (or PSU buttons) to set your appropiate battery voltage and restart");
         } else {
-          log("restoring from collapse");
-          psu_->enableOutput(true);
+          logFmt("%srestoring from collapse", c.tag_);
+          c.psu_->enableOutput(true);
         }
       }
-      if (psu_ && psu_->outEn_ && state_ != States::collapsemode) {
-        applyAdjustment(desired);
+      if (c.psu_ && c.psu_->outEn_ && c.state_ != States::collapsemode && !c.restoring()) { //loop() finishes restores first
+        applyAdjustment(c, desired);
+        if (atMpp_ && !firstAdjustMs_) {
+          firstAdjustMs_ = max(millis() - bootMs_, (uint32_t) 1);
+          logFmt("tracking %0.1fs after boot (%s start)", firstAdjustMs_ / 1000.0, warmBooted_? "warm" : "cold");
+          pub_.setDirty(pub_.id("firstadjust"));
+        }
       }
     }
-    backoffLevel_ = max(backoffLevel_ - 1, 0); //successes means less backoff
   } catch (const Backoff &b) {
-    backoffLevel_ = min(backoffLevel_ + 1, 8);
-    log(str("backoff now at %ds: ", getBackoff(adjustPeriod_) / 1000) + String(b.what()));
+    ret = b.what();
   }
-  if (collapses_.size() && (millis() - collapses_.front()) > (5 * 60000)) { //5m age
-    pub_.logNote(str("[clear collapse (%ds ago)]", (now - collapses_.pop_front())/1000));
-    pub_.setDirty("collapses");
+  if (c.collapses_.size() && (millis() - c.collapses_.front()) > (5 * 60000)) { //5m age
+    pub_.logNote("[clear collapse (%ds ago)]", (now - c.collapses_.pop_front())/1000);
+    pub_.setDirty(c.collapsesPub_);
   }
+  return ret;
 }
 
-void Solar::loop() {
-  uint32_t now = millis();
-  if (doOTAUpdate_.length())
-    return delay(100);
-
-  if (now > nextVmeas_) {
-    doMeasure(); //may set nextSolarAdjust sooner
-    doUpdateState();
-    nextVmeas_ = now + ((state_ == States::sweeping)? measperiod_ * 2 : measperiod_);
+uint32_t Solar::loop() {
+  if (doOTAUpdate_.length()) {
+    delay(100);
+    return 0;
   }
-
-  if (now > nextSolarAdjust_) {
-    doAdjust(doMeasure());
-    heap_caps_check_integrity_all(true);
-    nextSolarAdjust_ = now + getBackoff(adjustPeriod_);
+  StageTimer t(lat_[Stages::loop]);
+  if (cmdsWaiting_) runCommands();
+  for (int i = 0; i < channels_; i++) { //each psu on its own uart, their transactions overlap
+    Channel &c = ch_[i];
+    if (c.psu_) c.psu_->poll(); //never blocks, runs any queued PSU transactions
+    c.adc_.poll(); //only does anything if the sampler task isn't running
+    if (c.restoring()) doRestoreStep(c); //measuring and adjusting wait, everything else keeps running
   }
+  uint32_t idle = sched_.run();
+  for (int i = 0; i < channels_; i++)
+    if (ch_[i].restoring() || (ch_[i].psu_ && ch_[i].psu_->isAsync())) idle = min(idle, (uint32_t) 1); //these need polling
+  snapshot();
+  return idle;
+}
+
+void Solar::controlTask() {
+  controlTask_ = xTaskGetCurrentTaskHandle();
+  log("control task running");
+  while (true)
+    vTaskDelay(max(loop(), (uint32_t) 1) / portTICK_PERIOD_MS); //at least a tick, so the idle task gets fed
+}
 
-  if (now > nextPrint_) {
-    printStatus();
-    nextPrint_ = now + printPeriod_;
+//only the control task touches the psu, the uart and the tracking state. other
+//tasks hand it their sets and wait, a command takes at most one deadline to start
+String Solar::onControl(const StrFn &fn) {
+  if (!controlTask_ || xTaskGetCurrentTaskHandle() == controlTask_) return fn();
+  ControlCmd c(fn);
+  if (xSemaphoreTake(cmdLock_, 1000) != pdTRUE) throw std::runtime_error("control queue busy");
+  cmds_.push_back(&c);
+  cmdsWaiting_++;
+  xSemaphoreGive(cmdLock_);
+  for (uint32_t start = millis(); c.stage != ControlCmd::done; delay(1)) {
+    if (c.stage == ControlCmd::queued && (millis() - start) > 5000 && xSemaphoreTake(cmdLock_, 100) == pdTRUE) {
+      bool gaveUp = (c.stage == ControlCmd::queued); //c lives on this stack, it can't stay queued
+      if (gaveUp) {
+        cmds_.erase(std::find(cmds_.begin(), cmds_.end(), &c));
+        cmdsWaiting_--;
+      }
+      xSemaphoreGive(cmdLock_);
+      if (gaveUp) throw std::runtime_error("control task didn't get to it");
+    }
   }
+  if (c.failed) throw std::runtime_error(c.ret.c_str());
+  return c.ret;
+}
 
-  if (psu_ && now > nextPSUpdate_) {
-    if (!updatePSU()) {
-      log("psu update fail" + String(psu_->debug_? " serial debug output enabled" : ""));
-      psu_->begin(); //try and reconnect
+void Solar::runCommands() {
+  while (xSemaphoreTake(cmdLock_, 10) == pdTRUE) {
+    ControlCmd *c = cmds_.size()? cmds_.front() : nullptr;
+    if (c) {
+      cmds_.pop_front();
+      cmdsWaiting_--;
+      c->stage = ControlCmd::running;
     }
-    if ((inVolt_ > 1) && ((millis() - psu_->lastSuccess_) > 5 * 60 * 1000)) { //5m
-      log("VERY UNRESPONSIVE PSU, RESTARTING");
-      nextPub_ = now;
-      delay(1000);
-      ESP.restart();
+    xSemaphoreGive(cmdLock_);
+    if (!c) return;
+    try {
+      c->ret = c->fn();
+    } catch (const std::exception &e) {
+      c->ret = e.what();
+      c->failed = true;
     }
-    nextPSUpdate_ = now + min(getBackoff(5000), 100000); //100s
+    c->stage = ControlCmd::done; //the waiting task owns c again
   }
+}
 
-  if (lvProtect_ && now > lvProtect_->nextCheck_) {
-    if (!lvProtect_->isTriggered() && psu_ && psu_->outVolt_ < lvProtect_->threshold_) {
-      log(str("LOW VOLTAGE PROTECT TRIGGERED (now at %0.2fV)", psu_->outVolt_));
-      sendOutgoingLogs(); //send logs, tripping this relay may power us down
+void Solar::snapshot() {
+  Telemetry t = Telemetry();
+  t.ms = millis();
+  t.channels = channels_;
+  for (int i = 0; i < channels_; i++) {
+    const Channel &c = ch_[i];
+    ChannelTelemetry &ct = t.ch[i];
+    ct.inVolt = c.inVolt_;
+    ct.setpoint = c.setpoint_;
+    ct.offThreshold = c.offThreshold_;
+    ct.sweepSecs = c.sweepSecs_;
+    ct.sweepLostWh = c.sweepLostWh_;
+    ct.restoreSecs = c.restoreSecs_;
+    ct.collapses = c.getCollapses();
+    strncpy(ct.state, c.state_.c_str(), sizeof(ct.state) - 1);
+    if (c.psu_) {
+      ct.outVolt = c.psu_->outVolt_;
+      ct.outCurr = c.psu_->outCurr_;
+      ct.limitCurr = c.psu_->limitCurr_;
+      ct.currFilt = c.psu_->currFilt_;
+      ct.wh = c.psu_->wh_;
+      ct.outEn = c.psu_->outEn_;
+    }
+  }
+  telem_.write(t);
+}
+
+void Solar::snapshotSettings() {
+  Settings st = Settings();
+  strncpy(st.tracker, ch_[0].tracker_->name(), sizeof(st.tracker) - 1);
+  strncpy(st.sweepMode, sweepMode_.c_str(), sizeof(st.sweepMode) - 1);
+  if (lvProtect_) strncpy(st.lvProtect, lvProtect_->toString().c_str(), sizeof(st.lvProtect) - 1);
+  for (int i = 0; i < SOLAR_MAX_CHANNELS; i++)
+    if (ch_[i].psu_) strncpy(st.psu[i], ch_[i].psu_->getType().c_str(), sizeof(st.psu[i]) - 1);
+  auto drok = dynamic_cast<Drok*>(ch_[0].psu_.get());
+  st.drok = drok;
+  st.psuPipe = drok && drok->pipeline_;
+  settings_.write(st);
+}
+
+void Solar::addJobs() {
+  sched_.backoff_ = [this](uint32_t p) { return getBackoff(p); };
+  measJob_ = sched_.add("measure", &measperiod_, 1, [this] {
+    uint8_t live = 0; //channels not restoring, loop() has those
+    for (int i = 0; i < channels_; i++) if (!ch_[i].restoring()) live |= 1 << i;
+    if (!live) return sched_.after(measJob_, 25);
+    for (int i = 0; i < channels_; i++) if (live & (1 << i)) doMeasure(ch_[i]); //may pull the adjust job in
+    float curr = 0;
+    for (int i = 0; i < channels_; i++) if (ch_[i].psu_) curr += ch_[i].psu_->outCurr_;
+    Channel &c = ch_[0]; //the first panel, the whole bank's current
+    history_.record(millis(), c.inVolt_, c.psu_? c.psu_->outVolt_ : 0, curr, States::id(c.state_));
+    bool sweeping = false;
+    for (int i = 0; i < channels_; i++) if (live & (1 << i)) {
+      doUpdateState(ch_[i]);
+      sweeping |= (ch_[i].state_ == States::sweeping);
+    }
+    if (sweeping) sched_.after(measJob_, measperiod_ * 2);
+  });
+  adjustJob_ = sched_.add("adjust", &adjustPeriod_, 0, [this] {
+    int ran = 0, backedOff = 0;
+    const char *tag = "";
+    String why;
+    for (int i = 0; i < channels_; i++) {
+      Channel &c = ch_[i];
+      if (c.restoring()) continue;
+      doMeasure(c);
+      String w = doAdjust(c, track(c));
+      if (w.length()) { backedOff++; why = w; tag = c.tag_; }
+      checkpoint(c);
+      ran++;
+    }
+    if (!ran) return sched_.after(adjustJob_, 25);
+    if (backedOff < ran) backoffLevel_ = max(backoffLevel_ - 1, 0); //successes means less backoff
+    else { //only once every channel is stuck, a dark or faulted string shouldn't slow the others
+      backoffLevel_ = min(backoffLevel_ + 1, 8);
+      logFmt("%sbackoff now at %ds: %s", tag, getBackoff(adjustPeriod_) / 1000, why);
+    }
+    heap_caps_check_integrity_all(true);
+  }, true);
+  sched_.after(adjustJob_, 1000);
+  sched_.add("print", &printPeriod_, 3, [this] { for (int i = 0; i < channels_; i++) printStatus(ch_[i]); });
+  psuJob_ = sched_.add("psu", 5000, 2, [this] {
+    for (int i = 0; i < channels_; i++) {
+      Channel &c = ch_[i];
+      if (!c.psu_) continue;
+      if (!updatePSU(c)) {
+        logFmt("%spsu update fail%s", c.tag_, c.psu_->debug_? " serial debug output enabled" : "");
+        c.psu_->begin(); //try and reconnect
+      }
+      if ((c.inVolt_ > 1) && ((millis() - c.psu_->lastSuccess_) > 5 * 60 * 1000)) { //5m
+        logFmt("%sVERY UNRESPONSIVE PSU, RESTARTING", c.tag_);
+        nextPub_ = millis();
+        delay(1000);
+        ESP.restart();
+      }
+    }
+    sched_.after(psuJob_, min(getBackoff(5000), 100000)); //100s
+  });
+  lvJob_ = sched_.add("lvprotect", 100, 1, [this] {
+    PowerSupply *psu = ch_[0].psu_.get(); //all channels charge the same battery
+    if (!lvProtect_) return;
+    if (!lvProtect_->isTriggered() && psu && psu->outVolt_ < lvProtect_->threshold_) {
+      logFmt("LOW VOLTAGE PROTECT TRIGGERED (now at %0.2fV)", psu->outVolt_);
+      flushLogs_ = true; //the publish task sends them, tripping this relay may power us down
+      for (uint32_t start = millis(); flushLogs_ && millis() - start < 500; ) delay(5);
       delay(200);
       lvProtect_->trigger(true);
-      lvProtect_->nextCheck_ = now + 5 * 1000;
-    } else if (lvProtect_->isTriggered() && psu_ && psu_->outVolt_ > lvProtect_->threshRecovery_) {
+      sched_.after(lvJob_, 5 * 1000);
+    } else if (lvProtect_->isTriggered() && psu && psu->outVolt_ > lvProtect_->threshRecovery_) {
       log("low voltage recovery, re-enabling.");
       lvProtect_->trigger(false);
-      lvProtect_->nextCheck_ = now + 10000;
+      sched_.after(lvJob_, 10000);
+    }
+  });
+  sched_.add("latency", 60000, 3, [this] { pub_.setDirty(latPubs_); });
+  sweepJob_ = sched_.add("autosweep", 1000, 2, [this] {
+    uint32_t now = millis(), next = 0;
+    for (int i = 0; i < channels_; i++) { //whichever channels are due, then back for the earliest
+      if ((int32_t)(now - ch_[i].sweepDue_) >= 0) autoSweep(ch_[i]);
+      if (!i || (int32_t)(ch_[i].sweepDue_ - next) < 0) next = ch_[i].sweepDue_;
     }
+    sched_.at(sweepJob_, next);
+  });
+}
+
+void Solar::autoSweep(Channel &c) {
+  uint32_t now = millis();
+  if (autoSweep_ <= 0 || c.restoring()) { //check back in a second, or right after the restore
+    c.sweepDue_ = now + (c.restoring()? 25 : 1000);
+    return;
+  }
+  if (c.state_ == States::capped) {
+    logFmt("%sSkipping auto-sweep. Already at currentCap (%0.1fA)", c.tag_, capFor(c));
+    atMpp_ = true; //the cap is where it'd end up anyway, nothing to find
+  } else if (c.state_ == States::full_cv) {
+    logFmt("%sSkipping auto-sweep. Battery-full voltage reached (%0.1fV)", c.tag_, c.psu_->outVolt_);
+    atMpp_ = true;
+  } else if (c.state_ == States::mppt || c.state_ == States::collapsemode) {
+    logFmt("%sStarting AUTO-SWEEP (last run %0.1f mins ago)", c.tag_, (now - c.lastAutoSweep_)/1000.0/60.0);
+    startSweep(c);
   }
+  c.lastAutoSweep_ = now;
+  c.sweepDue_ = now + autoSweepIn(c);
+}
 
-  if (getCollapses() > 2)
-    nextAutoSweep_ = lastAutoSweep_ + autoSweep_ / 3.0 * 1000;
+void Solar::sweepAt(Channel &c, uint32_t due) {
+  c.sweepDue_ = due;
+  if (sched_.running() == sweepJob_) return; //it picks the earliest when it's done
+  for (int i = 0; i < channels_; i++)
+    if ((int32_t)(ch_[i].sweepDue_ - due) < 0) due = ch_[i].sweepDue_;
+  sched_.at(sweepJob_, due);
+}
 
-  if (autoSweep_ > 0 && (now > nextAutoSweep_)) {
-    if (state_ == States::capped) {
-      log(str("Skipping auto-sweep. Already at currentCap (%0.1fA)", currentCap_));
-    } else if (state_ == States::full_cv) {
-      log(str("Skipping auto-sweep. Battery-full voltage reached (%0.1fV)", psu_->outVolt_));
-    } else if (state_ == States::mppt || state_ == States::collapsemode) {
-      log(str("Starting AUTO-SWEEP (last run %0.1f mins ago)", (now - lastAutoSweep_)/1000.0/60.0));
-      startSweep();
-    }
-    nextAutoSweep_ = now + autoSweep_ * 1000;
-    lastAutoSweep_ = now;
+uint32_t Solar::autoSweepIn(const Channel &c) const { //sooner while the panel keeps collapsing
+  return (c.getCollapses() > 2)? autoSweep_ * 1000 / 3 : autoSweep_ * 1000;
+}
+
+//each channel gets its own cap, and while the others leave room, whatever the bank
+//has left. when they're all asking each is guaranteed an even share: the ones over
+//it are held down on their next adjustment, so the total settles within a period
+float Solar::capFor(const Channel &c) const {
+  if (bankCap_ <= 0) return currentCap_;
+  float others = 0;
+  int strings = 0; //populated, channels_ counts up to the highest one set
+  for (int i = 0; i < channels_; i++) {
+    if (ch_[i].psu_) strings++;
+    if (&ch_[i] != &c && ch_[i].psu_ && ch_[i].psu_->outEn_) others += ch_[i].psu_->limitCurr_;
+  }
+  return min(currentCap_, max(bankCap_ / max(strings, 1), bankCap_ - others));
+}
+
+bool Solar::restoring() const {
+  for (int i = 0; i < channels_; i++) if (ch_[i].restoring()) return true;
+  return false;
+}
+
+void Solar::checkpoint(Channel &c) { //only points worth coming back to. an unlearned (1000) off threshold is kept as is, the first restore learns it
+  if (!warmStart_ || !c.psu_ || !c.psu_->outEn_ || c.restoring()) return;
+  if (c.state_ != States::mppt && c.state_ != States::capped && c.state_ != States::full_cv) return;
+  Checkpoint k = {checkpointMagic, c.inVolt_, c.psu_->limitCurr_, c.offThreshold_, c.setpoint_, millis() - c.lastAutoSweep_, States::id(c.state_), {0}, 0};
+  k.crc = crc32(&k, offsetof(Checkpoint, crc));
+  checkpoint_[c.n_] = k;
+}
+
+//a reset (brownout, watchdog, ota) leaves the psu running and rtc memory intact. if
+//the panel is still near where it was, go straight back to tracking from there
+//instead of re-learning the off threshold and sweeping first
+bool Solar::warmStart(Channel &c) {
+  Checkpoint k = checkpoint_[c.n_];
+  checkpoint_[c.n_].magic = 0; //used once, a crash right after resuming shouldn't loop on it
+  if (!c.psu_ || k.magic != checkpointMagic || k.crc != crc32(&k, offsetof(Checkpoint, crc))) return false;
+  float in = measureInvolt(c);
+  if (in < c.psu_->outVolt_ || fabs(in - k.inVolt) > k.inVolt * 0.15) {
+    logFmt("%snot warm starting, panel at %0.1fV vs %0.1fV when checkpointed", c.tag_, in, k.inVolt);
+    return false;
   }
+  c.offThreshold_ = k.offThreshold;
+  if (k.setpoint > 0) c.setpoint_ = k.setpoint;
+  c.psu_->setCurrent(min(k.current, capFor(c)));
+  if (!c.psu_->outEn_) c.psu_->enableOutput(true);
+  c.psu_->currFilt_ = c.psu_->limitCurr_;
+  pub_.setDirty(c.offPub_);
+  pub_.setDirty(c.setpointPub_);
+  c.lastAutoSweep_ = millis() - min(k.sinceSweep, autoSweepIn(c)); //as if there'd been no reset
+  sweepAt(c, c.lastAutoSweep_ + autoSweepIn(c));
+  sched_.after(adjustJob_, 0);
+  atMpp_ = true;
+  if (c.offThreshold_ < 1000) logFmt("%swarm start at %0.2fA, %0.1fV in (was %s), off below %0.1fV", c.tag_, c.psu_->limitCurr_, in, States::name(k.state), c.offThreshold_);
+  else logFmt("%swarm start at %0.2fA, %0.1fV in (was %s), off threshold not learned yet", c.tag_, c.psu_->limitCurr_, in, States::name(k.state));
+  return true;
 }
 
 void Solar::sendOutgoingLogs() {
-  String s;
-  while (db_.client.connected() && pub_.popLog(&s))
-    db_.client.publish((db_.feed + "/log").c_str(), s.c_str(), false);
+  char line[LOG_LINE_SIZE];
+  FixedStr<64> topic;
+  bool online = db_.client.connected(), spill = !online && spilling();
+  topic.add("%s/log", db_.feed.c_str());
+  while (pub_.popLog(line, sizeof(line))) {
+    Serial.println(line);
+    if (online) db_.client.publish(topic.c_str(), line, false);
+    else if (spill) spill_.append("log", line);
+  }
+}
+
+void Solar::spillDirty() { //one batched snapshot, topics relative to the feed
+  int wins = pub_.publishDirty(db_.feed, [this](const char *topic, const char *val) {
+    return spill_.append(topic + db_.feed.length() + 1, val);
+  }, true);
+  pub_.logNote("[spill-%d %u]", wins, spill_.pending());
+}
+
+//oldest first, one record every 1000/spillrate ms. a refused publish is retried
+//after a second, so a struggling broker isn't buried in the backlog
+void Solar::replaySpill() {
+  uint32_t now = millis();
+  if (!spill_.pending() || spillRate_ <= 0 || (int32_t)(now - nextReplay_) < 0) return;
+  char buf[SPILL_MAX_RECORD];
+  SpillRecord r;
+  if (!spill_.peek(&r, buf, sizeof(buf))) return;
+  int32_t age = (r.boot == spill_.boot())? (now - r.ms) / 1000 : -1; //millis() from another boot mean nothing now
+  FixedStr<64> topic;
+  FixedStr<SPILL_MAX_RECORD + 32> msg;
+  if (!strcmp(r.topic, "log")) {
+    topic.add("%s/log", db_.feed.c_str());
+    if (age < 0) msg.add("[spilled before a restart] %s", r.payload);
+    else msg.add("[spilled %ds ago] %s", age, r.payload);
+  } else {
+    topic.add("%s/spill/%s", db_.feed.c_str(), r.topic);
+    msg.add("{\"age\":%d,\"v\":%s}", age, r.payload);
+  }
+  bool ok = db_.client.publish(topic.c_str(), msg.c_str(), false);
+  if (ok) spill_.consume();
+  nextReplay_ = now + (ok? 1000 / spillRate_ : 1000);
 }
 
 void Solar::publishTask() {
+  pub_.setLogConsumer();
   doConnect();
   db_.client.loop();
   db_.client.setCallback([=](char*topicbuf, uint8_t*buf, unsigned int len){
     String topic(topicbuf), val = str(std::string((char*)buf, len));
     log("got sub value " + topic + " -> " + val);
-    if (topic == (db_.feed + "/wh") && psu_) {
-      psu_->wh_ = (psu_->wh_ > 2.0)? val.toFloat() : psu_->wh_ + val.toFloat();
+    if (topic == (db_.feed + "/wh") && ch_[0].psu_) {
+      onControl([&]{ auto &psu_ = ch_[0].psu_; psu_->wh_ = (psu_->wh_ > 2.0)? val.toFloat() : psu_->wh_ + val.toFloat(); return ""; });
       log("restored wh value to " + val);
       db_.client.unsubscribe((db_.feed + "/wh").c_str());
     } else if (topic == db_.feed + "/cmd") {
@@ -532,44 +1122,113 @@ void Solar::publishTask() {
   db_.client.subscribe((db_.feed + "/wh").c_str());
 
   while (true) {
-    uint32_t now = millis();
-    if (now > nextPub_) {
-      while (doOTAUpdate_ == " ") //stops this task while an upload-OTA is running
-        delay(1000);
-      if (doOTAUpdate_.length()) {
-        doOTA(doOTAUpdate_);
-        doOTAUpdate_ = "";
+    publishStep();
+    delay(1);
+  }
+}
+
+void Solar::publishStep() {
+  if (flushLogs_) { //before anything that might block, the control task is waiting on it
+    sendOutgoingLogs();
+    flushLogs_ = false;
+  }
+  uint32_t now = millis();
+  bool online = db_.client.connected();
+  if (online && !wasOnline_) pub_.setAllDirty(); //retained topics catch up on whatever changed while away
+  wasOnline_ = online;
+  if ((int32_t)(now - nextPub_) >= 0) {
+    while (doOTAUpdate_ == " ") //stops this task while an upload-OTA is running
+      delay(1000);
+    if (doOTAUpdate_.length()) {
+      doOTA(doOTAUpdate_);
+      doOTAUpdate_ = "";
+    }
+    if (online) {
+      StageTimer t(lat_[Stages::publish]);
+      int wins = pub_.publishDirty(db_.feed, [this](const char *topic, const char *val) {
+        return db_.client.publish(topic, val, true);
+      });
+      pub_.logNote("[pub-%d]", wins);
+    } else {
+      pub_.logNote("[pub disconnected]");
+      if (spilling() && (int32_t)(now - nextSpill_) >= 0) {
+        spillDirty();
+        nextSpill_ = now + spillPeriod_ * 1000;
       }
-      if (db_.client.connected()) {
-        int wins = 0;
-        auto pubs = pub_.items(true);
-        for (auto i : pubs)
-          wins += db_.client.publish((db_.feed + "/" + (i->pref_? "prefs/":"") + i->key).c_str(), i->toString().c_str(), true)? 1 : 0;
-        pub_.logNote(str("[pub-%d]", wins));
-        pub_.clearDirty();
-      } else {
-        pub_.logNote("[pub disconnected]");
+      if ((int32_t)(now - nextConnect_) >= 0) { //4s, doubling to a minute. a wifi connect attempt blocks
         doConnect();
+        if (db_.client.connected()) connectFails_ = 0;
+        else {
+          nextConnect_ = millis() + min(4000 << connectFails_, 60000);
+          if (connectFails_ < 4) connectFails_++;
+        }
       }
-      sendOutgoingLogs();
-      heap_caps_check_integrity_all(true);
-      nextPub_ = now + ((psu_ && psu_->outEn_)? db_.period : db_.period * 4); //slower when disabled
     }
-    db_.client.loop();
-    pub_.poll(&Serial);
-    server_.handleClient();
-    delay(1);
+    heap_caps_check_integrity_all(true);
+    nextPub_ = now + (telemetry().anyOn()? db_.period : db_.period * 4); //slower when all are disabled
+  }
+  db_.client.loop();
+  if (online) replaySpill();
+  sendOutgoingLogs();
+  pub_.poll(&Serial);
+  server_.handleClient();
+  if (events_.size() && (int32_t)(now - nextEvents_) >= 0) {
+    pushEvents();
+    nextEvents_ = now + max(eventPeriod_, 50);
+  }
+  if (events_.size()) flushEvents();
+}
+
+//one event per push, nothing when nothing changed but a comment every 15s so a
+//dropped connection is noticed. it's queued, flushEvents() does the writing
+void Solar::pushEvents() {
+  uint32_t now = millis();
+  bool started = false;
+  pub_.popChanges([&](const char *s, size_t l) {
+    for (auto &e : events_) {
+      if (!started) e.backlog += "data: ";
+      e.backlog.append(s, l);
+    }
+    started = true;
+  });
+  if (started || (now - lastEvent_) > 15000) {
+    for (auto &e : events_) e.backlog += started? "\n\n" : ":\n\n";
+    lastEvent_ = now;
   }
 }
 
-void Solar::printStatus() {
-  String s = state_;
-  s.toUpperCase();
-  s += str(" %0.1fVin -> %0.2fWh ", inVolt_, psu_? psu_->wh_ : 0) + (psu_? psu_->toString() : "[no PSU]");
-  if (lvProtect_ && lvProtect_->isTriggered()) s += " [LV PROTECTED]";
-  s += pub_.popNotes();
-  if (psu_ && psu_->debug_) log(s);
-  else Serial.println(s);
+//the webserver's client writes wait on a full socket, a slow reader would hold up
+//the publish task. these never wait: what doesn't fit stays queued for the next
+//pass, and a client that's gone or SOLAR_EVENT_BACKLOG behind is let go
+void Solar::flushEvents() {
+  for (auto e = events_.begin(); e != events_.end(); ) {
+    int sent = e->backlog.size()? lwip_send(e->client.fd(), e->backlog.data(), e->backlog.size(), MSG_DONTWAIT) : 0;
+    if (sent > 0) e->backlog.erase(0, sent);
+    bool gone = (sent < 0 && errno != EAGAIN && errno != EWOULDBLOCK) || !e->client.connected();
+    if (!gone && e->backlog.size() <= SOLAR_EVENT_BACKLOG) {
+      e++;
+      continue;
+    }
+    e->client.stop();
+    e = events_.erase(e);
+    logFmt("events stream %s, %d left", gone? "closed" : "dropped, it fell behind", events_.size());
+  }
+}
+
+void Solar::printStatus(Channel &c) {
+  StageTimer t(lat_[Stages::print]);
+  FixedStr<256> s;
+  s.cat(c.tag_);
+  s.cat(c.state_.c_str());
+  for (size_t i = 0; i < s.length(); i++) s[i] = toupper(s[i]);
+  s.add(" %0.1fVin -> %0.2fWh ", c.inVolt_, c.psu_? c.psu_->wh_ : 0);
+  if (c.psu_) c.psu_->print(s);
+  else s.cat("[no PSU]");
+  if (lvProtect_ && lvProtect_->isTriggered()) s.cat(" [LV PROTECTED]");
+  if (c.restoring()) s.add(" [RESTORING %0.1fs]", (millis() - c.restore_.start) / 1000.0);
+  pub_.popNotes(s);
+  if (c.psu_ && c.psu_->debug_) logFmt("%s", s.c_str());
+  else Serial.println(s.c_str());
 }
 
 int Solar::getBackoff(int period) const {
@@ -577,12 +1236,20 @@ int Solar::getBackoff(int period) const {
   return ((backoffLevel_ * backoffLevel_ + 2) / 2) * period;
 }
 
-void Solar::setState(const String state, String reason) {
-  if (state_ != state) {
-    pub_.setDirty("state");
-    log("state change to " + state + " (from " + state_ + ") " + reason);
+constexpr const char* States::all[];
+uint8_t States::id(const String &state) {
+  for (uint8_t i = 0; i < sizeof(all) / sizeof(all[0]); i++)
+    if (state == all[i]) return i;
+  return 0;
+}
+const char* States::name(uint8_t id) { return (id < sizeof(all) / sizeof(all[0]))? all[id] : "?"; }
+
+void Solar::setState(Channel &c, const String state, String reason) {
+  if (c.state_ != state) {
+    pub_.setDirty(c.statePub_);
+    logFmt("%sstate change to %s (from %s) %s", c.tag_, state, c.state_, reason);
   }
-  state_ = state;
+  c.state_ = state;
 }
 
 int DBConnection::getPort() const {
@@ -601,7 +1268,7 @@ void Solar::doOTA(String url) {
   esp_task_wdt_init(120, true); //way longer watchdog timeout
   t_httpUpdate_return ret = httpUpdate.update(espClient, url, version_);
   if (ret == HTTP_UPDATE_FAILED) {
-    log(str("[OTA] Error (%d):", httpUpdate.getLastError()) + httpUpdate.getLastErrorString());
+    logFmt("[OTA] Error (%d):%s", httpUpdate.getLastError(), httpUpdate.getLastErrorString());
   } else if (ret == HTTP_UPDATE_NO_UPDATES) {
     log("[OTA] no updates");
   } else if (ret == HTTP_UPDATE_OK) {
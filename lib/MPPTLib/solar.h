@@ -1,5 +1,15 @@
 #pragma once
 #include "publishable.h"
+#include "trackers.h"
+#include "adcSampler.h"
+#include "scheduler.h"
+#include "seqLock.h"
+#include "latency.h"
+#include "history.h"
+#include "spillLog.h"
+#include <deque>
+#include <string>
+#include <vector>
 #include <WString.h>
 #include <PubSubClient.h>
 #include <WebServer.h>
@@ -21,56 +31,211 @@ struct SPoint {
   double p() const { return v * i; }
 };
 
+struct GoldenSweep { //bracket, then golden-section search of power vs current limit
+  float a, b, c, d, step; //interval, interior probes, bracketing step
+  double pc, pd;
+  uint8_t phase; //bracketing, probing c, probing d
+  uint8_t settle; //steps to wait for psu readings that reflect the probe
+  SPoint prev, prev2, best, bestClps; //best un-collapsed and collapsed probes
+  float prevLimit, prev2Limit; //current limits prev and prev2 were probed at, the bracket ends
+};
+
+struct Restore { //collapse recovery: current dropped, waiting for the panel voltage to come back
+  uint32_t start = 0, nextCheck = 0;
+  float current = 0; //to set once recovered
+  float then = -1; //adjustment to make once it has been set, <0 none
+  int32_t adjustIn = -1; //ms from recovering to the next adjustment, <0 leaves the adjust job be
+  bool active = false;
+};
+
+struct Checkpoint { //the last good operating point, in rtc memory so it outlives a reset
+  uint32_t magic;
+  float inVolt, current, offThreshold;
+  double setpoint;
+  uint32_t sinceSweep; //ms, so the sweep schedule carries on
+  uint8_t state, pad[3];
+  uint32_t crc; //of everything above
+};
+
+#define SOLAR_MAX_CHANNELS 4 //panel strings, each into its own psu, all into one battery bank
+#define SOLAR_MAX_EVENT_STREAMS 4 //open /events connections
+#define SOLAR_EVENT_BACKLOG 4096 //bytes an /events client can fall behind by before it's dropped
+
+//one panel string and its converter. everything tracking needs is per channel, the
+//bank, the scheduler and the network side are shared. channel 0 keeps the plain pub
+//names, the others add their number (involt2, psu3)
+struct Channel {
+  uint8_t n_ = 0;
+  char tag_[8] = ""; //log prefix, once there's more than one channel
+  std::unique_ptr<PowerSupply> psu_;
+  std::unique_ptr<Tracker> tracker_;
+  String state_;
+  int pinInvolt_ = 32;
+  AdcSampler adc_; //input pin, when the psu can't measure its own input
+  float inVolt_ = 0;
+  double setpoint_ = 0;
+  float offThreshold_ = 1000.0; //starts high to force update
+  CircularArray<uint32_t, 32> collapses_;
+  CircularArray<SPoint, 10> sweepPoints_; //size here is important, larger == more stable setpoint
+  GoldenSweep golden_;
+  uint32_t sweepStart_ = 0, lastAutoSweep_ = 0, sweepDue_ = 0;
+  float sweepStartWh_ = 0;
+  double sweepSecs_ = 0, sweepLostWh_ = 0; //last sweep, lost is vs running at the point it found
+  Restore restore_;
+  double restoreSecs_ = 0; //last restore
+  PubMask psuPubs_, adjustPubs_, sweepPubs_; //precomputed, psuPubs_ marked dirty every poll
+  PubId whPub_ = NO_PUB, collapsesPub_ = NO_PUB, statePub_ = NO_PUB, setpointPub_ = NO_PUB, involtPub_ = NO_PUB;
+  PubId restorePub_ = NO_PUB, offPub_ = NO_PUB;
+
+  Channel();
+  ~Channel();
+  bool restoring() const { return restore_.active; }
+  int getCollapses() const { return collapses_.size(); }
+  String suffix() const { return n_? String(n_ + 1) : String(); }
+};
+
+struct ChannelTelemetry {
+  float inVolt, outVolt, outCurr, limitCurr, currFilt, wh, offThreshold;
+  double setpoint, sweepSecs, sweepLostWh, restoreSecs;
+  bool outEn;
+  uint8_t collapses;
+  char state[16];
+};
+
+struct Telemetry { //what the network side reads, published by the control task after every loop()
+  uint32_t ms;
+  uint8_t channels;
+  ChannelTelemetry ch[SOLAR_MAX_CHANNELS];
+  float bankCurr() const { float r = 0; for (int i = 0; i < channels; i++) r += ch[i].outCurr; return r; }
+  float bankPower() const { float r = 0; for (int i = 0; i < channels; i++) r += ch[i].outVolt * ch[i].outCurr; return r; }
+  bool anyOn() const { for (int i = 0; i < channels; i++) if (ch[i].outEn) return true; return false; }
+};
+
+struct Settings { //the string prefs the network side reads, rewritten by the control task when one changes
+  char tracker[12], sweepMode[8], lvProtect[24];
+  char psu[SOLAR_MAX_CHANNELS][24]; //as set, empty when the channel has none
+  bool drok, psuPipe; //the first channel's
+};
+
+struct EventStream { //an /events client and what its socket hasn't taken yet
+  WiFiClient client;
+  std::string backlog;
+};
+
+struct ControlCmd { //a set or action from another task, waiting for the control task to run it
+  const StrFn &fn;
+  String ret;
+  bool failed = false;
+  std::atomic<uint8_t> stage; //queued, running, done
+  enum { queued, running, done };
+  ControlCmd(const StrFn &f) : fn(f), stage(queued) { }
+};
+
+struct Stages { enum { loop, measure, adjust, psu, print, publish, count }; }; //timed into Solar::lat_
+
 class Solar {
 public:
   Solar(String version);
   ~Solar();
   void setup();
   String setLVProtect(String);
-  String setPSU(String);
+  String setPSU(Channel &, String);
+  void addChannelPubs(Channel &); //the numbered copies of the telemetry items
+  void channelPubIds(Channel &);
 
-  void loop();
-  float doMeasure();
-  void doUpdateState();
-  void doAdjust(float desired);
+  uint32_t loop(); //ms until anything is due
+  void controlTask(); //loop() forever, pinned
+  String onControl(const StrFn &); //runs fn on the control task and waits for it
+  void runCommands();
+  void snapshot();
+  Telemetry telemetry() const { return telem_.read(); }
+  void snapshotSettings(); //after any of them changes
+  Settings settings() const { return settings_.read(); }
+  void addJobs();
+  uint32_t autoSweepIn(const Channel &) const;
+  void sweepAt(Channel &, uint32_t due); //the job runs at the earliest of the channels'
+  void autoSweep(Channel &);
+  float capFor(const Channel &) const; //currentcap, or less if the bank is near its cap
+  void doMeasure(Channel &);
+  float track(Channel &);
+  void quickAdjust();
+  void doUpdateState(Channel &);
+  String doAdjust(Channel &, float desired); //why it backed off, empty if it didn't
+  void checkpoint(Channel &);
+  bool warmStart(Channel &); //resumes at the checkpoint if the panel still looks the same
 
-  bool updatePSU();
-  float measureInvolt();
+  bool updatePSU(Channel &);
+  float measureInvolt(Channel &);
   void sendOutgoingLogs();
   void publishTask();
+  void publishStep(); //one pass of the publish task's loop
+  void spillDirty(); //offline: dirty telemetry into the spill log
+  void replaySpill(); //online: the spill log back out, rate limited
+  void pushEvents(); //what changed, to the /events streams
+  void flushEvents(); //as much of each backlog as its socket takes without blocking
+  bool spilling() const { return spillPeriod_ > 0 && spill_.ready() && db_.serv.length() && db_.feed.length(); }
   void doConnect();
-  void applyAdjustment(float current);
-  void printStatus();
-  void startSweep();
-  void doSweepStep();
-  bool hasCollapsed() const;
-  int getCollapses() const;
-  void restoreFromCollapse(float restoreCurrent);
+  void applyAdjustment(Channel &, float current);
+  void printStatus(Channel &);
+  void startSweep(Channel &);
+  void doSweepStep(Channel &);
+  void doGoldenStep(Channel &);
+  void endSweep(Channel &, double bestPower);
+  bool hasCollapsed(const Channel &) const;
+  void restoreFromCollapse(Channel &, float restoreCurrent, float then = -1); //starts the restore, loop() finishes it
+  void doRestoreStep(Channel &);
+  void adjustAfter(Channel &, uint32_t ms); //counts from the end of a restore, like the blocking one did
+  bool restoring() const; //any channel
   void doOTA(String url);
 
   int getBackoff(int period) const;
-  void setState(const String state, String reason="");
+  void setState(Channel &, const String state, String reason="");
+  template<typename... A>
+  void logFmt(const char *fmt, const A&... args) const { const_cast<Publishable&>(pub_).logFmt(fmt, args...); } //ours, not the last registered logger
+  void log(const String &s) const { logFmt("%s", s); }
 
   const String version_;
   String id_;
-  String state_;
-  int pinInvolt_ = 32;
-  float inVolt_ = 0;
-  double setpoint_ = 0, pgain_ = 0.005, ramplimit_ = 12;
-  double currentCap_ = 8.5;
-  CircularArray<uint32_t, 32> collapses_;
+  Channel ch_[SOLAR_MAX_CHANNELS];
+  uint8_t channels_ = 1; //in use, the first always is
+  double pgain_ = 0.005, ramplimit_ = 12;
+  double currentCap_ = 8.5; //per channel
+  double bankCap_ = 0; //A into the battery from all channels together, 0 is none
+  double trackStep_ = 0.1; //A per adjustment, perturb and inccond
   int measperiod_ = 200, printPeriod_ = 1000, adjustPeriod_ = 2000;
   int autoSweep_ = 10 * 60; //every 10m
   float vadjust_ = 116.50;
-  float offThreshold_ = 1000.0; //starts high to force update
-  CircularArray<SPoint, 10> sweepPoints_; //size here is important, larger == more stable setpoint
+  String sweepMode_ = "linear"; //or golden
+  bool warmStart_ = true, warmBooted_ = false, atMpp_ = false; //atMpp_: swept or resumed since boot
+  uint32_t bootMs_ = 0, firstAdjustMs_ = 0; //first tracking adjustment at a known mpp, after setup() started
   String wifiap, wifipass;
   uint32_t lastConnected_ = 0;
   int8_t backoffLevel_ = 0;
+  SpillLog spill_;
+  int spillPeriod_ = 60, spillRate_ = 20; //s between spilled snapshots, records/s replayed
+  uint32_t nextSpill_ = 0, nextReplay_ = 0, nextConnect_ = 0;
+  uint8_t connectFails_ = 0;
+  bool wasOnline_ = false;
+  std::atomic<bool> flushLogs_{false}; //set by the control task, cleared once the publish task has sent the logs
   std::unique_ptr<LowVoltageProtect> lvProtect_;
+  Scheduler sched_;
+  Scheduler::JobId measJob_, adjustJob_, psuJob_, lvJob_, sweepJob_;
+  uint32_t nextPub_ = 20000;
+
+  LatencyHist lat_[Stages::count];
+  History history_;
+  PubMask latPubs_;
+  SeqLock<Telemetry> telem_;
+  SeqLock<Settings> settings_;
+  void* controlTask_ = nullptr; //set once the task runs, until then everything is inline
+  std::deque<ControlCmd*> cmds_;
+  std::atomic<uint8_t> cmdsWaiting_;
+  SemaphoreHandle_t cmdLock_;
 
-  std::unique_ptr<PowerSupply> psu_;
   WebServer server_;
+  std::vector<EventStream> events_; //server-sent event streams, written by the publish task
+  int eventPeriod_ = 500; //ms between pushes
+  uint32_t nextEvents_ = 0, lastEvent_ = 0, etagSalt_ = 0;
   Publishable pub_;
   DBConnection db_;
 };
@@ -85,6 +250,9 @@ struct States {
   STATE(full_cv);
   STATE(capped);
   STATE(collapsemode);
+  static uint8_t id(const String &state); //index into all, for compact storage
+  static const char* name(uint8_t id);
+  static constexpr const char* all[] = {error, off, mppt, sweeping, full_cv, capped, collapsemode};
 };
 
 
@@ -93,7 +261,6 @@ struct LowVoltageProtect {
   float threshold_ = 12.0;
   float threshRecovery_ = 13.0;
   bool invert_ = false;
-  uint32_t nextCheck_ = 0;
   String toString() const;
   LowVoltageProtect(String configuration);
   ~LowVoltageProtect();
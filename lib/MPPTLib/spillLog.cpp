@@ -0,0 +1,168 @@
+#include "spillLog.h"
+#include <cstddef>
+
+static const uint32_t sectorMagic = 0x314c5053; //"SPL1"
+static uint16_t align4(uint16_t v) { return (v + 3) & ~3; }
+static uint8_t crc8(const uint8_t *d, size_t l) {
+  uint8_t c = 0;
+  while (l--) {
+    c ^= *d++;
+    for (int i = 0; i < 8; i++) c = (c & 0x80)? (c << 1) ^ 0x07 : c << 1;
+  }
+  return c;
+}
+
+bool SpillLog::next(Pos *p) const {
+  uint8_t s = (p->sector + 1) % sectors_;
+  if (p->sector == head_.sector || seq_[s] != seq_[p->sector] + 1) return false;
+  *p = {s, sizeof(SectorHdr)};
+  return true;
+}
+
+bool SpillLog::readHdr(Pos p, RecHdr *h) const {
+  if (p.off + sizeof(RecHdr) > SPILL_SECTOR) return false;
+  if (esp_partition_read(part_, addr(p), h, sizeof(RecHdr)) != ESP_OK) return false;
+  return h->len != 0xffff && p.off + sizeof(RecHdr) + h->len <= SPILL_SECTOR;
+}
+
+bool SpillLog::openSector(uint8_t s, uint32_t seq) {
+  if (esp_partition_erase_range(part_, s * SPILL_SECTOR, SPILL_SECTOR) != ESP_OK) return false;
+  erases_++;
+  SectorHdr h = {sectorMagic, seq};
+  if (esp_partition_write(part_, s * SPILL_SECTOR, &h, sizeof(h)) != ESP_OK) return false;
+  seq_[s] = seq;
+  head_ = {s, sizeof(SectorHdr)};
+  return true;
+}
+
+//walks every record once: the newest sector is the head, the oldest one still
+//holding anything pending is where replay resumes
+bool SpillLog::begin() {
+  if (!lock_) lock_ = xSemaphoreCreateMutex();
+  part_ = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_DATA_SPIFFS, NULL);
+  if (!part_) return false;
+  sectors_ = min((uint32_t) SPILL_SECTORS, part_->size / SPILL_SECTOR);
+  uint8_t newest = 0, oldest;
+  for (uint8_t s = 0; s < sectors_; s++) {
+    SectorHdr h;
+    esp_partition_read(part_, s * SPILL_SECTOR, &h, sizeof(h));
+    seq_[s] = (h.magic == sectorMagic)? h.seq : 0;
+    if (seq_[s] && (!seq_[newest] || seq_[s] > seq_[newest])) newest = s;
+  }
+  pending_ = 0;
+  hasPeek_ = false;
+  if (!seq_[newest]) return openSector(0, 1); //blank, or not ours
+  head_ = {newest, sizeof(SectorHdr)};
+  oldest = newest;
+  for (uint8_t i = 1; i < sectors_; i++) { //only the unbroken run of sequence numbers up to the head counts
+    uint8_t s = (newest + sectors_ - i) % sectors_;
+    if (!seq_[s] || seq_[s] + i != seq_[newest]) break;
+    oldest = s;
+  }
+  read_ = {oldest, sizeof(SectorHdr)};
+  bool found = false;
+  for (Pos p = read_; ; ) {
+    RecHdr h;
+    if (readHdr(p, &h)) {
+      boot_ = max(boot_, h.boot);
+      if (h.state == complete) {
+        if (!found) read_ = p;
+        found = true;
+        pending_++;
+      }
+      p.off += align4(sizeof(RecHdr) + h.len);
+      if (p.sector == head_.sector) head_ = p;
+    } else if (!next(&p)) break;
+  }
+  if (!found) read_ = head_;
+  boot_++;
+  return true;
+}
+
+bool SpillLog::append(const char *topic, const char *payload) {
+  size_t tl = strlen(topic) + 1, pl = strlen(payload) + 1;
+  if (!part_ || tl + pl > SPILL_MAX_RECORD) return false;
+  if (xSemaphoreTake(lock_, 100) != pdTRUE) return false;
+  uint8_t buf[sizeof(RecHdr) + SPILL_MAX_RECORD + 3];
+  RecHdr h = {(uint16_t)(tl + pl), blank, 0, millis(), boot_, 0xffff};
+  memcpy(buf + sizeof(RecHdr), topic, tl);
+  memcpy(buf + sizeof(RecHdr) + tl, payload, pl);
+  h.crc = crc8(buf + sizeof(RecHdr), h.len);
+  memcpy(buf, &h, sizeof(h));
+  uint16_t need = align4(sizeof(RecHdr) + h.len);
+  bool ok = true;
+  if (head_.off + need > SPILL_SECTOR) { //wrap onto the next sector, dropping what's left in it
+    uint8_t s = (head_.sector + 1) % sectors_;
+    if (seq_[s] && read_.sector == s) {
+      RecHdr o;
+      for (Pos p = read_; readHdr(p, &o); p.off += align4(sizeof(RecHdr) + o.len))
+        if (o.state == complete) { pending_--; dropped_++; }
+      read_ = {(uint8_t)((s + 1) % sectors_), sizeof(SectorHdr)};
+      hasPeek_ = false;
+    }
+    ok = openSector(s, seq_[head_.sector] + 1);
+    if (!pending_) read_ = head_;
+  }
+  if (ok) ok = esp_partition_write(part_, addr(head_), buf, sizeof(RecHdr) + h.len) == ESP_OK;
+  uint8_t done = complete;
+  if (ok) ok = esp_partition_write(part_, addr(head_) + offsetof(RecHdr, state), &done, 1) == ESP_OK;
+  if (ok) {
+    if (!pending_++) read_ = head_;
+    head_.off += need;
+    appended_++;
+  }
+  xSemaphoreGive(lock_);
+  return ok;
+}
+
+void SpillLog::skipDone() {
+  RecHdr h;
+  while (true) {
+    if (!readHdr(read_, &h)) {
+      if (!next(&read_)) return;
+    } else if (h.state == complete) return;
+    else read_.off += align4(sizeof(RecHdr) + h.len);
+  }
+}
+
+bool SpillLog::peek(SpillRecord *r, char *buf, size_t len) {
+  if (!part_ || !pending_ || xSemaphoreTake(lock_, 100) != pdTRUE) return false;
+  bool ok = false;
+  while (!ok && pending_) {
+    skipDone();
+    RecHdr h;
+    if (!readHdr(read_, &h) || h.state != complete) break;
+    ok = h.len <= len && esp_partition_read(part_, addr(read_) + sizeof(RecHdr), buf, h.len) == ESP_OK
+        && crc8((uint8_t*) buf, h.len) == h.crc && !buf[h.len - 1];
+    if (!ok) { //corrupt, or too big for the caller. mark it so it's never seen again
+      uint8_t c = consumed;
+      esp_partition_write(part_, addr(read_) + offsetof(RecHdr, state), &c, 1);
+      read_.off += align4(sizeof(RecHdr) + h.len);
+      pending_--;
+      dropped_++;
+      continue;
+    }
+    r->ms = h.ms;
+    r->boot = h.boot;
+    r->topic = buf;
+    r->payload = buf + strlen(buf) + 1;
+    peeked_ = read_;
+    hasPeek_ = true;
+  }
+  xSemaphoreGive(lock_);
+  return ok;
+}
+
+void SpillLog::consume() {
+  if (!hasPeek_ || xSemaphoreTake(lock_, 100) != pdTRUE) return;
+  RecHdr h;
+  if (peeked_.sector == read_.sector && peeked_.off == read_.off && readHdr(read_, &h)) {
+    uint8_t c = consumed;
+    esp_partition_write(part_, addr(read_) + offsetof(RecHdr, state), &c, 1);
+    read_.off += align4(sizeof(RecHdr) + h.len);
+    pending_--;
+    replayed_++;
+  }
+  hasPeek_ = false;
+  xSemaphoreGive(lock_);
+}
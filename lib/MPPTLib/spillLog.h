@@ -0,0 +1,52 @@
+#pragma once
+#include <Arduino.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <esp_partition.h>
+
+#define SPILL_SECTORS 16     //64KB of the (otherwise unused) spiffs partition, at most
+#define SPILL_SECTOR 4096
+#define SPILL_MAX_RECORD 600 //topic + payload
+
+struct SpillRecord {
+  uint32_t ms; //millis() when it was written
+  uint16_t boot; //which boot wrote it, ms only means something within one
+  const char *topic, *payload; //into the caller's buffer
+};
+
+//what couldn't be published, kept in raw flash until it can be. an append-only
+//ring of sectors: records are only ever written once and marked consumed by
+//clearing bits in place, a sector is erased only when the ring wraps onto it, so
+//every sector sees the same (low) erase count. when full the oldest sector is
+//dropped. a record is marked complete after its payload lands, so a power cut
+//mid-write leaves a record that's skipped rather than garbage
+class SpillLog {
+public:
+  struct Pos { uint8_t sector; uint16_t off; };
+  bool begin(); //finds the partition and picks up where the last boot left off
+  bool ready() const { return part_ != nullptr; }
+  bool append(const char *topic, const char *payload); //any task
+  bool peek(SpillRecord *, char *buf, size_t len); //oldest pending
+  void consume(); //the one peek() returned
+  uint32_t pending() const { return pending_; }
+  uint16_t boot() const { return boot_; }
+  uint32_t appended_ = 0, replayed_ = 0, dropped_ = 0, erases_ = 0;
+  uint32_t regionBytes() const { return sectors_ * SPILL_SECTOR; }
+private:
+  struct SectorHdr { uint32_t magic, seq; };
+  struct RecHdr { uint16_t len; uint8_t state, crc; uint32_t ms; uint16_t boot, pad; };
+  enum : uint8_t { blank = 0xff, complete = 0xfe, consumed = 0x00 };
+  const esp_partition_t *part_ = nullptr;
+  SemaphoreHandle_t lock_ = nullptr;
+  uint8_t sectors_ = 0;
+  uint32_t seq_[SPILL_SECTORS] = {0}; //0 is erased/unused
+  Pos head_ = {0, 0}, read_ = {0, 0}, peeked_ = {0, 0};
+  uint32_t pending_ = 0;
+  uint16_t boot_ = 0;
+  bool hasPeek_ = false;
+  uint32_t addr(Pos p) const { return p.sector * SPILL_SECTOR + p.off; }
+  bool next(Pos *p) const; //to the following sector in the ring, false past the head
+  bool readHdr(Pos p, RecHdr *h) const;
+  bool openSector(uint8_t s, uint32_t seq);
+  void skipDone(); //read_ past consumed/torn records
+};
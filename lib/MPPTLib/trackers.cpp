@@ -0,0 +1,54 @@
+#include "trackers.h"
+#include "solar.h"
+#include "powerSupplies.h"
+#include <Arduino.h>
+
+Tracker* Tracker::make(String name) {
+  if (name == "setpoint") return new SetpointTracker();
+  if (name == "perturb")  return new PerturbObserve();
+  if (name == "inccond")  return new IncConductance();
+  return nullptr;
+}
+
+void SetpointTracker::sample(Solar &s, Channel &c) {
+  double error = c.inVolt_ - c.setpoint_;
+  if ((error > 0.3 || (-error > 0.2)) && (error < 0.6) && (c.state_ == States::mppt)) { //ramp down, quick!
+    s.pub_.logNote("[QUICK]");
+    s.quickAdjust();
+  }
+}
+
+float SetpointTracker::track(Solar &s, Channel &c) {
+  double error = c.inVolt_ - c.setpoint_;
+  double dcurr = constrain(error * s.pgain_, -s.ramplimit_ * 2, s.ramplimit_); //limit ramping speed
+  if (error > 0.3 || (-error > 0.2)) //adjustment deadband, more sensitive when needing to ramp down
+    return c.psu_->limitCurr_ + dcurr;
+  return c.psu_->limitCurr_;
+}
+
+float PerturbObserve::track(Solar &s, Channel &c) {
+  double p = c.psu_->outVolt_ * c.psu_->outCurr_;
+  if (p < lastP_) dir_ = -dir_; //last step went downhill
+  lastP_ = p;
+  if (c.inVolt_ < c.setpoint_ * 0.95) dir_ = -1; //well under the swept mpp, a step up would collapse
+  return max(0.0f, c.psu_->limitCurr_ + dir_ * (float) s.trackStep_);
+}
+
+float IncConductance::track(Solar &s, Channel &c) {
+  float v = c.inVolt_, limit = c.psu_->limitCurr_, step = s.trackStep_;
+  double i = (v > 1)? c.psu_->outVolt_ * c.psu_->outCurr_ / v : 0; //panel current, at constant efficiency
+  if (primed_ && fabs(limit - lastLimit_) > 0.001) { //the last step landed, read the slope it made
+    double dv = v - lastV_, di = i - lastI_;
+    if (fabs(dv) < 0.02) { //panel didn't move, fall back to power
+      if (di < 0) dir_ = -dir_;
+    } else {
+      double g = di / dv + i / v; //zero at the mpp, positive to its left
+      if (fabs(g) < 0.05 * i / v) { dir_ = -dir_; step /= 2; } //there, dither around it
+      else dir_ = (g > 0)? -1 : 1; //left of the mpp less current lets the voltage rise
+    }
+  }
+  if (v < c.setpoint_ * 0.95) dir_ = -1; //well under the swept mpp, a step up would collapse
+  primed_ = true;
+  lastV_ = v; lastI_ = i; lastLimit_ = limit;
+  return max(0.0f, limit + dir_ * step);
+}
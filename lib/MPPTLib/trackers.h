@@ -0,0 +1,51 @@
+#pragma once
+#include <WString.h>
+
+class Solar;
+struct Channel;
+
+//mppt strategy. sample() runs every measurement, track() every adjustment and
+//returns the current limit to apply. Solar only drives them while in control,
+//one per channel
+class Tracker {
+public:
+  static Tracker* make(String name); //null if unknown
+  static constexpr const char* names = "setpoint, perturb or inccond (experimental, trails setpoint in the sim but for light clouds)";
+  virtual ~Tracker() { }
+  virtual const char* name() const = 0;
+  virtual void sample(Solar &, Channel &) { }
+  virtual float track(Solar &, Channel &) = 0;
+  virtual void reset() { } //after sweeps and collapses, history no longer applies
+};
+
+//proportional on input voltage vs the setpoint the last sweep found
+class SetpointTracker : public Tracker {
+public:
+  const char* name() const override { return "setpoint"; }
+  void sample(Solar &, Channel &) override;
+  float track(Solar &, Channel &) override;
+};
+
+//steps the current limit, reverses whenever output power fell
+class PerturbObserve : public Tracker {
+  double lastP_ = 0;
+  int8_t dir_ = 1;
+public:
+  const char* name() const override { return "perturb"; }
+  float track(Solar &, Channel &) override;
+  void reset() override { lastP_ = 0; dir_ = -1; }
+};
+
+//dI/dV vs -I/V on the panel side, input current estimated from output power.
+//holds with a half step dither once it's there
+//in the sim it trails setpoint on clear days and perturb under clouds, see the readme
+class IncConductance : public Tracker {
+  float lastV_ = 0, lastLimit_ = 0;
+  double lastI_ = 0;
+  int8_t dir_ = 1;
+  bool primed_ = false;
+public:
+  const char* name() const override { return "inccond"; }
+  float track(Solar &, Channel &) override;
+  void reset() override { primed_ = false; dir_ = -1; }
+};
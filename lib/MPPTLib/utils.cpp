@@ -9,12 +9,31 @@ float mapfloat(long x, long in_min, long in_max, long out_min, long out_max) {
 }
 
 String str(const char *fmtStr, ...) {
-  static char buf[201] = {'\0'};
+  FixedStr<201> buf; //on the stack, so concurrent callers don't share it
   va_list arg_ptr;
   va_start(arg_ptr, fmtStr);
-  vsnprintf(buf, 200, fmtStr, arg_ptr);
+  buf.addv(fmtStr, arg_ptr);
   va_end(arg_ptr);
-  return String(buf);
+  return String(buf.c_str());
+}
+
+StrBuf& StrBuf::add(const char *fmt, ...) {
+  va_list args;
+  va_start(args, fmt);
+  addv(fmt, args);
+  va_end(args);
+  return *this;
+}
+StrBuf& StrBuf::addv(const char *fmt, va_list args) {
+  if (full()) return *this;
+  int l = vsnprintf(buf_ + len_, size_ - len_, fmt, args);
+  if (l > 0) len_ = min(len_ + l, size_ - 1);
+  return *this;
+}
+StrBuf& StrBuf::cat(const char *s) {
+  while (s && *s && !full()) buf_[len_++] = *s++;
+  buf_[len_] = 0;
+  return *this;
 }
 String str(const std::string &s) {
   return String(s.c_str());
@@ -36,20 +55,32 @@ bool suffixed(String *str, const String &suff) {
   return res;
 }
 
+uint32_t crc32(const void *data, size_t len) {
+  const uint8_t *d = (const uint8_t*) data;
+  uint32_t c = 0xffffffff;
+  while (len--) {
+    c ^= *d++;
+    for (int i = 0; i < 8; i++) c = (c >> 1) ^ (0xEDB88320UL & -(c & 1));
+  }
+  return ~c;
+}
+
 // float lifepo4_soc[] = {13.4, 13.3, 13.28, 13.};
 
 Publishable* pub_; //static
 void log(const String &s) { pub_->log(s); }
 void addLogger(Publishable* p) { pub_ = p; }
+Publishable* logger() { return pub_; }
 
 String timeAgo(int sec) {
   int days = (sec / (3600 * 24));
-  String ret = str("%ds", sec % 60);
-  if (sec >= 60  ) ret = str("%dm ", (sec % 3600) / 60) + ret;
-  if (sec >= 3600) ret = str("%dh ", ((sec % (3600 * 24)) / 3600)) + ret;
-  if (days)        ret = str("%dd ", days % 365) + ret;
-  if (days >= 365) ret = str("%dy ", days / 365) + ret;
-  return ret;
+  FixedStr<40> ret;
+  if (days >= 365) ret.add("%dy ", days / 365);
+  if (days)        ret.add("%dd ", days % 365);
+  if (sec >= 3600) ret.add("%dh ", ((sec % (3600 * 24)) / 3600));
+  if (sec >= 60  ) ret.add("%dm ", (sec % 3600) / 60);
+  ret.add("%ds", sec % 60);
+  return ret.c_str();
 }
 
 String getResetReason(RESET_REASON r) {
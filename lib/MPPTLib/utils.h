@@ -1,4 +1,5 @@
 #pragma once
+#include <stdarg.h>
 
 class Publishable;
 
@@ -12,13 +13,42 @@ float mapfloat(long x, long in_min, long in_max, long out_min, long out_max);
 
 extern const char* adafruitRootCert;
 
-String str(const char *fmtStr, ...);
+#define PRINTF_FMT(f, a) __attribute__((format(printf, f, a))) //compiler checks the args
+
+String str(const char *fmtStr, ...) PRINTF_FMT(1, 2); //allocates, prefer StrBuf on hot paths
 String str(const std::string &s);
 String str(bool v);
 
+//printf-appends into a buffer the caller owns (stack, member). never allocates,
+//truncates when full, and shares nothing so any task can use one
+class StrBuf {
+  char *buf_;
+  size_t size_, len_;
+public:
+  StrBuf(char *buf, size_t size) : buf_(buf), size_(size), len_(0) { buf_[0] = 0; }
+  StrBuf(const StrBuf &) = delete;
+  StrBuf& add(const char *fmt, ...) PRINTF_FMT(2, 3);
+  StrBuf& addv(const char *fmt, va_list);
+  StrBuf& cat(const char *s);
+  StrBuf& cat(const StrBuf &s) { return cat(s.c_str()); }
+  void clear() { len_ = 0; buf_[0] = 0; }
+  const char* c_str() const { return buf_; }
+  char& operator[](size_t i) { return buf_[i]; }
+  size_t length() const { return len_; }
+  bool full() const { return len_ + 1 >= size_; }
+};
+
+template<size_t N>
+class FixedStr : public StrBuf {
+  char mem_[N];
+public:
+  FixedStr() : StrBuf(mem_, N) { }
+};
+
 typedef std::pair<String,String> StringPair;
 StringPair split(const String &str, const String &del);
 bool suffixed(String *str, const String &suff);
+uint32_t crc32(const void *data, size_t len);
 
 template<typename T, uint16_t Size>
 class CircularArray {
@@ -8,5 +8,5 @@ void setup() {
   controller.setup();
 }
 void loop() {
-  controller.loop();
+  vTaskDelete(NULL); //control runs on its own pinned task, started by setup()
 }
@@ -0,0 +1,188 @@
+//fleet load test: N controllers in one process, each a host unit with its own rig,
+//drok and threads, all publishing to one in-process broker on the wall clock. the
+//broker is a single thread working through a queue, the way mosquitto works through
+//its sockets, so once the fleet outruns it the queue and the latencies grow
+#include "fleet.h"
+#include <solar.h>
+#include <hostShim.h>
+#include <simRig.h>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "../version.h"
+
+class Broker {
+  struct Msg { std::string topic, payload; bool retained; int unit; uint64_t us; }; //unit 0 is the harness
+  std::mutex lock_;
+  std::condition_variable wake_;
+  std::deque<Msg> queue_;
+  std::map<std::string, std::string> retained_;
+  std::vector<uint64_t> cmdSent_; //by unit, 0 when none is outstanding
+  void handle(const Msg &);
+public:
+  LatencyHist publish_, cmd_; //publish() until routed, a /cmd sent until its result is logged back
+  std::vector<uint32_t> msgs_; //by unit, 0 is the harness
+  uint32_t retainedMsgs_ = 0, logMsgs_ = 0, cmdsLost_ = 0, maxDepth_ = 0;
+  uint64_t bytes_ = 0;
+
+  Broker(int units) : cmdSent_(units + 1, 0), msgs_(units + 1, 0) {
+    publish_.name_ = "publish to broker";
+    cmd_.name_ = "/cmd round trip";
+  }
+  bool publish(const char *topic, const char *payload, bool retained, int unit = hostUnit()); //any thread
+  bool command(int unit, const String &feed, const char *cmd); //false while the last is outstanding
+  size_t topics() { std::lock_guard<std::mutex> l(lock_); return retained_.size(); }
+  void run(); //the broker's own thread
+};
+
+bool Broker::publish(const char *topic, const char *payload, bool retained, int unit) {
+  std::lock_guard<std::mutex> l(lock_);
+  queue_.push_back({topic, payload, retained, unit, hostClock().micros64()});
+  maxDepth_ = max(maxDepth_, (uint32_t) queue_.size());
+  wake_.notify_one();
+  return true;
+}
+
+bool Broker::command(int unit, const String &feed, const char *cmd) {
+  uint64_t now = hostClock().micros64();
+  {
+    std::lock_guard<std::mutex> l(lock_);
+    if (cmdSent_[unit] && now - cmdSent_[unit] < 10000000) return false;
+    if (cmdSent_[unit]) cmdsLost_++; //10s and nothing, give up on it
+    cmdSent_[unit] = now;
+  }
+  return publish((feed + "/cmd").c_str(), cmd, false, 0);
+}
+
+void Broker::handle(const Msg &m) {
+  uint64_t now = hostClock().micros64();
+  msgs_[m.unit]++;
+  bytes_ += m.topic.length() + m.payload.length();
+  if (m.retained) {
+    retainedMsgs_++;
+    std::lock_guard<std::mutex> l(lock_);
+    retained_[m.topic] = m.payload;
+  }
+  hostMqttDeliver(m.topic.c_str(), m.payload.c_str());
+  if (!m.unit) return;
+  publish_.record(now - m.us);
+  if (m.topic.length() < 4 || m.topic.compare(m.topic.length() - 4, 4, "/log")) return;
+  logMsgs_++;
+  if (m.payload.find("MQTT cmd ") == std::string::npos) return;
+  std::lock_guard<std::mutex> l(lock_);
+  if (cmdSent_[m.unit]) cmd_.record(now - cmdSent_[m.unit]);
+  cmdSent_[m.unit] = 0;
+}
+
+void Broker::run() {
+  while (true) {
+    Msg m;
+    {
+      std::unique_lock<std::mutex> l(lock_);
+      wake_.wait(l, [this]{ return !queue_.empty(); });
+      m = std::move(queue_.front());
+      queue_.pop_front();
+    }
+    handle(m);
+  }
+}
+
+void runFleet(const FleetOpts &o) {
+  setHostClock(nullptr); //units run their own control and publish tasks, on the wall clock
+  setConsoleQuiet(!o.verbose);
+  Broker broker(o.units);
+  std::thread([&]{ broker.run(); }).detach();
+  setHostNetwork(true, [&](const char *topic, const char *payload, bool retained) { return broker.publish(topic, payload, retained); });
+
+  std::vector<std::unique_ptr<SimRig>> rigs;
+  std::vector<std::unique_ptr<SimDrok>> droks;
+  std::vector<Solar*> solars;
+  setAnalogSource([&](uint8_t pin) { return rigs[hostUnit() - 1]->adcCounts(); });
+  for (int i = 0; i < o.units; i++) {
+    setHostUnit(i + 1); //its nvs, flash, serial pins and mac, inherited by the tasks setup() starts
+    rigs.emplace_back(new SimRig(o.seed + i));
+    rigs.back()->startHour_ = o.startHour;
+    rigs.back()->panel_.isc *= 1 - 0.2 * i / o.units; //so they don't all publish in lockstep
+    droks.emplace_back(new SimDrok(*rigs.back()));
+    attachSerialPin(16, droks.back().get());
+    solars.push_back(new Solar(GIT_VERSION));
+    solars.back()->pub_.batch_ = o.batch;
+    solars.back()->setup();
+  }
+  for (int i = 0; i < o.units; i++) {
+    setHostUnit(i + 1);
+    std::list<String> cmds = {"psu=drok:16,17sw", "wifiap=sim", "wifipass=sim", "mqttServ=localhost",
+        str("mqttFeed=fleet/%02d", i + 1), "setpoint=35", "warmstart=off"}; //they'd all share one rtc memory
+    cmds.insert(cmds.end(), o.cmds.begin(), o.cmds.end());
+    for (auto c : cmds) {
+      String ret = solars[i]->pub_.handleCmd(c);
+      if (o.verbose) fprintf(stderr, "[fleet %d] %s -> %s\n", i + 1, c.c_str(), ret.c_str());
+    }
+  }
+  setHostUnit(0);
+
+  auto stepRigs = [&]{ for (auto &r : rigs) r->step(); };
+  uint64_t waitUntil = hostClock().micros64() + 40000000; //the first publish is 20s after boot
+  for (int ready = 0; ready < o.units && hostClock().micros64() < waitUntil; delay(100)) {
+    stepRigs();
+    ready = 0;
+    for (auto s : solars) ready += s->pub_.published_ > 0;
+  }
+  broker.publish_.reset();
+  broker.cmd_.reset();
+  broker.maxDepth_ = 0; //not the connect burst
+  for (auto s : solars) s->lat_[Stages::publish].reset();
+  std::vector<uint32_t> startMsgs = broker.msgs_;
+  uint32_t startRetained = broker.retainedMsgs_, startLogs = broker.logMsgs_;
+  uint64_t startBytes = broker.bytes_, start = hostClock().micros64(), end = start + o.secs * 1e6;
+  std::vector<uint64_t> nextCmd(o.units);
+  for (int i = 0; i < o.units; i++) nextCmd[i] = start + (uint64_t) o.cmdMs * 1000 * i / o.units; //staggered
+  uint32_t cmdsSent = 0;
+  for (uint64_t now = start; now < end; now = hostClock().micros64()) {
+    stepRigs();
+    for (int i = 0; i < o.units; i++)
+      if (now >= nextCmd[i] && broker.command(i + 1, solars[i]->db_.feed, "version")) {
+        cmdsSent++;
+        nextCmd[i] = now + o.cmdMs * 1000ULL;
+      }
+    delay(10);
+  }
+  double secs = (hostClock().micros64() - start) / 1e6;
+
+  uint32_t msgs = 0, least = UINT32_MAX, most = 0;
+  for (int i = 1; i <= o.units; i++) {
+    uint32_t n = broker.msgs_[i] - startMsgs[i];
+    msgs += n;
+    least = min(least, n);
+    most = max(most, n);
+  }
+  uint32_t pubCycles = 0, pubP99 = 0, pubMax = 0;
+  double pubMean = 0;
+  for (auto s : solars) {
+    const LatencyHist &h = s->lat_[Stages::publish];
+    pubCycles += h.count();
+    pubMean += h.mean() * h.count();
+    pubP99 = max(pubP99, h.percentile(0.99));
+    pubMax = max(pubMax, h.max());
+  }
+  printf("fleet: %d units for %0.1fs, pubperiod %dms, %s telemetry\n", o.units, secs,
+      solars[0]->db_.period, o.batch? "batched" : "per-item retained");
+  printf("fleet: broker handled %u unit msgs (%0.0f/s, %0.1fKB/s): %u retained, %u log, queue peaked at %u\n",
+      msgs, msgs / secs, (broker.bytes_ - startBytes) / secs / 1024, broker.retainedMsgs_ - startRetained,
+      broker.logMsgs_ - startLogs, broker.maxDepth_);
+  printf("fleet: per unit %0.1f to %0.1f msgs/s, %u retained topics held\n", least / secs, most / secs, (uint32_t) broker.topics());
+  FixedStr<128> line;
+  broker.publish_.print(line);
+  printf("fleet: %s\n", line.c_str());
+  line.clear();
+  broker.cmd_.print(line);
+  printf("fleet: %s, %u sent, %u lost\n", line.c_str(), cmdsSent, broker.cmdsLost_);
+  printf("fleet: units' publish cycles: %u, mean %0.0fus, worst unit p99 %uus, max %uus\n",
+      pubCycles, pubCycles? pubMean / pubCycles : 0, pubP99, pubMax);
+  fflush(stdout);
+  _Exit(0); //skip teardown, everything here is still in use
+}
@@ -0,0 +1,14 @@
+#pragma once
+#include <Arduino.h>
+#include <list>
+
+struct FleetOpts {
+  int units = 8;
+  float secs = 20, startHour = 12;
+  uint32_t seed = 1;
+  int cmdMs = 1000; //between one unit's /cmd round trips
+  bool batch = false, verbose = false;
+  std::list<String> cmds; //--set, applied to every unit
+};
+
+[[noreturn]] void runFleet(const FleetOpts &); //prints its report and exits, the units' tasks never stop
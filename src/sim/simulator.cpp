@@ -0,0 +1,373 @@
+//linux host simulator: runs the real Solar controller against a simulated
+//panel + Drok converter on a virtual clock. build with `pio run -e native`
+#include <solar.h>
+#include <powerSupplies.h>
+#include <hostShim.h>
+#include <simRig.h>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <random>
+#include <vector>
+#include <rom/rtc.h>
+#include "../version.h"
+#include "fleet.h"
+#include "trackerTests.h"
+
+void usage() {
+  puts("usage: program [options]\n"
+       "  --hours H       simulated duration (24)\n"
+       "  --start-hour H  time of day the run starts at (0, 12 for --fleet)\n"
+       "  --tick US       virtual time per loop() call (1000)\n"
+       "  --clouds F      0..1 depth of passing cloud shade (0)\n"
+       "  --batt V        battery resting voltage (25.6)\n"
+       "  --seed N        adc noise seed (1)\n"
+       "  --psu TYPE      simulated supply on Serial2: drok or dps (drok)\n"
+       "  --channels N    panel strings, each with its own supply. 2+ are on software serial (1)\n"
+       "  --set key=val   any Publishable command, applied after setup (repeatable)\n"
+       "  --get URI       http GET against the controller after the run, prints the body (repeatable)\n"
+       "  --events        hold an /events stream open through the run, print how many updates it got\n"
+       "  --stalled-events  hold another whose reader never reads, it should be dropped, not hold up the rest\n"
+       "  --offline A:B   wifi and mqtt down from hour A to hour B of the run, exercises the spill log\n"
+       "  --reboot H      brownout-reset the controller H hours into the run, the psu keeps going (repeatable)\n"
+       "  --realtime      wall-clock time, starts the control and publish tasks\n"
+       "  --decode FILE   print a /history dump as csv and exit, times relative to the dump\n"
+       "  --at UNIXTIME   with --decode, when the dump was fetched: times become unix ms\n"
+       "  --fleet N       N controllers on their own threads against one in-process mqtt broker, for --secs\n"
+       "                  of wall time. reports broker msgs/s, publish latency and /cmd round trips, then exits\n"
+       "  --secs S        length of a --fleet run (20)\n"
+       "  --batch         with --fleet, batched telemetry instead of a retained message per item\n"
+       "  --bench         time string formatting (StrBuf vs str()) and the adc pipeline, then exit\n"
+       "  --test-trackers check the perturb and inccond step decisions on scripted readings, exit 1 if any fail\n"
+       "  --verbose       show the controller's serial console");
+}
+
+//str() as it used to be: one shared static buffer, copied out into a String
+String oldStr(const char *fmtStr, ...) {
+  static char buf[201] = {'\0'};
+  va_list arg_ptr;
+  va_start(arg_ptr, fmtStr);
+  vsnprintf(buf, 200, fmtStr, arg_ptr);
+  va_end(arg_ptr);
+  return String(buf);
+}
+
+//a printStatus() sized line, built both ways
+void benchFormat() {
+  const int n = 500000;
+  size_t sink = 0;
+  auto run = [&](const char *name, std::function<void(int)> fn) {
+    uint64_t allocs = hostAllocs();
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < n; i++) fn(i);
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    printf("bench: %-24s %6.0fns/line, %0.2f allocs/line\n", name, ns / n, (double)(hostAllocs() - allocs) / n);
+  };
+  run("str() + String", [&](int i) {
+    String s = "MPPT";
+    s += oldStr(" %0.1fVin -> %0.2fWh ", 43.1 + i % 7, 120.55) + oldStr("PSU-out[%0.2fV %0.2fA]-lim[%0.2fV %0.2fA]", 26.6, 3.3, 28.8, 3.35);
+    s += " ENABLED";
+    s += oldStr(" [adjusting %0.3fA (from %0.3fA)]", 0.013, 3.337);
+    sink += s.length();
+  });
+  run("FixedStr<256> on stack", [&](int i) {
+    FixedStr<256> s;
+    s.cat("MPPT");
+    s.add(" %0.1fVin -> %0.2fWh ", 43.1 + i % 7, 120.55);
+    s.add("PSU-out[%0.2fV %0.2fA]-lim[%0.2fV %0.2fA]", 26.6, 3.3, 28.8, 3.35);
+    s.cat(" ENABLED");
+    s.add(" [adjusting %0.3fA (from %0.3fA)]", 0.013, 3.337);
+    sink += s.length();
+  });
+  printf("bench: (%zu chars)\n", sink);
+}
+
+//the input pin pipeline fed a noisy, spiky constant: error of one raw read vs
+//the filtered value, and the cost of a tick
+void benchAdc() {
+  const int n = 200000;
+  const float truth = 2000;
+  std::mt19937 rng(1);
+  std::normal_distribution<float> noise(0, 25);
+  std::uniform_real_distribution<float> spike(0, 1);
+  SampleSource src = [&]() -> uint16_t {
+    float c = truth + noise(rng) + ((spike(rng) < 0.01)? 400 : 0);
+    return constrain(c, 0.0f, 4095.0f);
+  };
+  double rawErr = 0, filtErr = 0;
+  for (int i = 0; i < n; i++) rawErr += pow(src() - truth, 2);
+  AdcSampler adc(src);
+  adc.begin(false);
+  for (int i = 0; i < 100; i++) adc.tick(); //settle
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < n; i++) {
+    adc.tick();
+    filtErr += pow(adc.latest() - truth, 2);
+  }
+  double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+  printf("bench: adc %dms x%d: %0.0fns/tick, rms error %0.1f counts raw read vs %0.1f filtered\n",
+      adc.periodMs_, adc.oversample_, ns / n, sqrt(rawErr / n), sqrt(filtErr / n));
+}
+
+//a /history body to csv. rows is how many to print, the count decoded is returned
+int decodeHistory(const std::string &body, double at, size_t rows) {
+  uint32_t now = 0;
+  size_t n = 0;
+  puts("ms,involt,outvolt,outcurr,power,state");
+  int ret = History::decode((const uint8_t*) body.data(), body.size(), [&](const HistSample &s) {
+    if (n++ >= rows) return;
+    double t = at? at * 1000 - (double)(now - s.ms) : -(double)(now - s.ms);
+    printf("%0.0f,%0.2f,%0.2f,%0.2f,%0.2f,%s\n", t, s.v[0], s.v[1], s.v[2], s.power(), States::name(s.state));
+  }, &now);
+  if (ret < 0) fprintf(stderr, "not a /history dump, or truncated\n");
+  return ret;
+}
+
+int main(int argc, char **argv) {
+  float hours = 24, startHour = -1, clouds = 0, batt = 25.6, offFrom = -1, offTo = -1;
+  uint32_t tickUs = 1000, seed = 1, channels = 1;
+  bool realtime = false, verbose = false, events = false, stalledEvents = false;
+  FleetOpts fleet;
+  fleet.units = 0;
+  String psu = "drok", decode;
+  double at = 0;
+  std::list<String> cmds, gets;
+  std::list<float> reboots;
+  for (int i = 1; i < argc; i++) {
+    String a = argv[i], v = (i + 1 < argc)? argv[i + 1] : "";
+    if      (a == "--hours")      { hours = v.toFloat(); i++; }
+    else if (a == "--start-hour") { startHour = v.toFloat(); i++; }
+    else if (a == "--tick")       { tickUs = v.toInt(); i++; }
+    else if (a == "--clouds")     { clouds = v.toFloat(); i++; }
+    else if (a == "--batt")       { batt = v.toFloat(); i++; }
+    else if (a == "--seed")       { seed = v.toInt(); i++; }
+    else if (a == "--psu")        { psu = v; i++; }
+    else if (a == "--channels")   { channels = constrain(v.toInt(), 1, SOLAR_MAX_CHANNELS); i++; }
+    else if (a == "--set")        { cmds.push_back(v); i++; }
+    else if (a == "--get")        { gets.push_back(v); i++; }
+    else if (a == "--reboot")     { reboots.push_back(v.toFloat()); i++; }
+    else if (a == "--offline")    { offFrom = split(v, ":").first.toFloat(); offTo = split(v, ":").second.toFloat(); i++; }
+    else if (a == "--decode")     { decode = v; i++; }
+    else if (a == "--at")         { at = v.toFloat(); i++; }
+    else if (a == "--fleet")      { fleet.units = max(1L, v.toInt()); i++; }
+    else if (a == "--secs")       { fleet.secs = v.toFloat(); i++; }
+    else if (a == "--batch")      fleet.batch = true;
+    else if (a == "--events")     events = true;
+    else if (a == "--stalled-events") stalledEvents = true;
+    else if (a == "--realtime")   realtime = true;
+    else if (a == "--verbose")    verbose = true;
+    else if (a == "--bench")      { benchFormat(); benchAdc(); return 0; }
+    else if (a == "--test-trackers") return runTrackerTests()? 1 : 0;
+    else { usage(); return a == "--help"? 0 : 1; }
+  }
+
+  if (decode.length()) {
+    std::ifstream f(decode.c_str(), std::ios::binary);
+    std::string body((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+    return decodeHistory(body, at, SIZE_MAX) < 0;
+  }
+
+  if (fleet.units) {
+    if (startHour >= 0) fleet.startHour = startHour;
+    fleet.seed = seed;
+    fleet.verbose = verbose;
+    fleet.cmds = cmds;
+    runFleet(fleet);
+  }
+  startHour = max(startHour, 0.0f);
+
+  VirtualClock vclock;
+  RealClock rclock;
+  if (realtime) setHostClock(&rclock);
+  else setHostClock(&vclock);
+  setConsoleQuiet(!verbose);
+
+  std::vector<std::unique_ptr<SimRig>> rigs; //one per string, same sky and battery
+  std::vector<std::unique_ptr<SimDrok>> droks;
+  std::vector<std::unique_ptr<SimDps>> dpses;
+  std::list<String> psus;
+  for (uint32_t i = 0; i < channels; i++) {
+    rigs.emplace_back(new SimRig(seed + i));
+    SimRig &r = *rigs.back();
+    r.startHour_ = startHour;
+    r.clouds_ = clouds;
+    r.battVolt_ = batt;
+    r.panel_.isc *= 1 - 0.1 * i; //the later strings a little shaded, so they don't all agree
+    droks.emplace_back(new SimDrok(r));
+    dpses.emplace_back(new SimDps(r));
+    Stream *dev = (psu == "dps")? (Stream*) dpses.back().get() : droks.back().get();
+    if (!i) Serial2.attach(dev);
+    else {
+      attachSerialPin(10 + i, dev);
+      psus.push_back(str("psu%d=%s:%d,%dsw", i + 1, psu.c_str(), 10 + i, 20 + i));
+    }
+  }
+  cmds.insert(cmds.begin(), psus.begin(), psus.end());
+  cmds.push_front("setpoint=35");
+  if (psu == "drok") cmds.push_front("psupipe=on"); //every 16th update stays sequential, so both timings get reported
+  for (auto c : {"wifiap=sim", "wifipass=sim", "mqttServ=localhost", "mqttFeed=sim"})
+    cmds.push_front(c);
+  std::atomic<uint32_t> mqttMsgs(0), mqttSpilled(0); //the publish task counts from its own thread in realtime
+  setHostNetwork(true, [&](const char *topic, const char *payload, bool) {
+    mqttMsgs++;
+    if (strstr(topic, "/spill/") || !strncmp(payload, "[spilled", 8)) mqttSpilled++;
+    return true;
+  });
+  cmds.push_front("psu=" + psu);
+  setAnalogSource([&](uint8_t pin) { return rigs[(pin - 32) % channels]->adcCounts(); }); //inPin, inPin2.. default to 32, 33..
+
+  auto solar = new Solar(GIT_VERSION);
+  solar->setup();
+  std::list<std::pair<float, Solar*>> booted; //by a --reboot
+  for (auto c : cmds)
+    fprintf(stderr, "[sim] %s -> %s\n", c.c_str(), solar->pub_.handleCmd(c).c_str());
+
+  WebServer::Response stream;
+  if (events) stream = solar->server_.hostRequest(HTTP_GET, "/events");
+  WebServer::Response stalled;
+  float stalledDropH = -1;
+  if (stalledEvents) {
+    stalled = solar->server_.hostRequest(HTTP_GET, "/events");
+    if (stalled.stream) stalled.stream->window = 0; //a socket nobody drains, full from the start
+  }
+
+  std::map<String, double> stateSecs;
+  uint32_t sweeps = 0, loops = 0, pubCycles = 0, pubMsgs = 0;
+  uint64_t pubAllocs = 0;
+  double sweepSecs = 0, sweepLostWh = 0;
+  uint64_t blockedUs = 0, maxStallUs = 0; //virtual time spent inside loop()
+  uint64_t sleptUs = 0; //between loop() calls, nothing was due
+  String lastState = solar->ch_[0].state_;
+  auto wallStart = std::chrono::steady_clock::now();
+  uint64_t startUs = hostClock().micros64(), endUs = startUs + hours * 3.6e9, nextSampleUs = 0, lastSampleUs = startUs;
+  while (hostClock().micros64() < endUs) {
+    double runH = (hostClock().micros64() - startUs) / 3.6e9;
+    bool down = runH >= offFrom && runH < offTo;
+    if (down == hostNetworkUp()) setHostNetwork(!down);
+    if (stalled.stream && !stalled.stream->open && stalledDropH < 0) stalledDropH = runH;
+    if (reboots.size() && runH >= reboots.front()) { //the old instance is just abandoned, rtc memory and nvs carry over
+      reboots.pop_front();
+      setResetReason(RTCWDT_BROWN_OUT_RESET);
+      solar = new Solar(GIT_VERSION);
+      solar->setup();
+      booted.emplace_back(runH, solar);
+    }
+    if (realtime) delay(10); //the control task runs loop() on its own thread
+    else {
+      uint64_t before = hostClock().micros64();
+      uint32_t idle = solar->loop();
+      uint64_t stall = hostClock().micros64() - before;
+      blockedUs += stall;
+      maxStallUs = max(maxStallUs, stall);
+      loops++;
+      uint64_t sleep = min(idle * 1000ULL, 100000ULL); //keep the rig integrating at 100ms or finer
+      sleptUs += sleep;
+      vclock.advance(max((uint64_t) tickUs, sleep));
+    }
+    uint64_t now = hostClock().micros64();
+    if (!realtime) { //stands in for the publish task, which only runs in realtime
+      bool due = (int32_t)(millis() - solar->nextPub_) >= 0;
+      uint64_t allocs = hostAllocs();
+      uint32_t msgs = mqttMsgs;
+      solar->publishStep();
+      if (due) {
+        pubMsgs += mqttMsgs - msgs;
+        if (pubCycles++) pubAllocs += hostAllocs() - allocs; //the first cycle builds the topics
+      }
+    }
+    if (now >= nextSampleUs) {
+      for (auto &r : rigs) r->step();
+      Channel &c = solar->ch_[0]; //the others run the same way
+      stateSecs[c.state_] += (now - lastSampleUs) / 1e6; //loop() may have blocked for a while
+      lastSampleUs = now;
+      if (c.state_ == States::sweeping && lastState != States::sweeping) sweeps++;
+      if (c.state_ != States::sweeping && lastState == States::sweeping) {
+        sweepSecs += c.sweepSecs_;
+        sweepLostWh += c.sweepLostWh_;
+      }
+      lastState = c.state_;
+      nextSampleUs = now + 100000;
+    }
+  }
+  double whOut = 0, whAvail = 0, whCounted = 0;
+  uint32_t collapses = 0, transactions = 0;
+  for (uint32_t i = 0; i < channels; i++) {
+    SimRig &r = *rigs[i];
+    r.step();
+    whOut += r.whOut_;
+    whAvail += r.whAvail_;
+    collapses += r.collapses_;
+    transactions += droks[i]->commands_ + dpses[i]->frames_;
+    whCounted += solar->ch_[i].psu_? solar->ch_[i].psu_->wh_ : 0;
+  }
+  double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - wallStart).count();
+
+  printf("sim: %0.1fh simulated in %0.2fs wall (%0.0fx realtime), %u loop() calls\n",
+      hours, wall, hours * 3600 / wall, loops);
+  printf("sim: harvested %0.1fWh of %0.1fWh available (%0.1f%% tracking), controller counted %0.1fWh\n",
+      whOut, whAvail, whAvail > 0? 100 * whOut / whAvail : 0, whCounted);
+  for (uint32_t i = 0; channels > 1 && i < channels; i++)
+    printf("sim:   string %u: %0.1fWh of %0.1fWh (%0.1f%%), %u collapses, %s\n", i + 1, rigs[i]->whOut_, rigs[i]->whAvail_,
+        rigs[i]->whAvail_ > 0? 100 * rigs[i]->whOut_ / rigs[i]->whAvail_ : 0, rigs[i]->collapses_, solar->ch_[i].state_.c_str());
+  printf("sim: loop() blocked %0.2f%% of the time, longest call %0.1fms, idle until the next deadline %0.1f%%\n",
+      100 * blockedUs / (hours * 3.6e9), maxStallUs / 1000.0, 100 * sleptUs / (hours * 3.6e9));
+  printf("sim: %u panel collapses, %u sweeps, %u psu transactions\n", collapses, sweeps, transactions);
+  if (sweeps)
+    printf("sim: %s sweeps took %0.1fs and lost %0.3fWh on average (%0.2fWh total)\n",
+        solar->sweepMode_.c_str(), sweepSecs / sweeps, sweepLostWh / sweeps, sweepLostWh);
+  if (pubCycles > 1)
+    printf("sim: %u publish cycles, %0.1f msgs each, %0.2f heap allocs/cycle after the first (%u String fallbacks, %u coalesced)\n",
+        pubCycles, (double) pubMsgs / pubCycles, (double) pubAllocs / (pubCycles - 1), solar->pub_.fallbacks_, solar->pub_.coalesced_);
+  for (const auto &b : booted) {
+    FixedStr<24> at; //0 is it never got there, not instantly
+    if (b.second->firstAdjustMs_) at.add("%0.1fs later", b.second->firstAdjustMs_ / 1000.0);
+    else at.cat("never");
+    printf("sim: rebooted at %0.2fh, %s start, tracking at a known mpp %s\n", b.first,
+        b.second->warmBooted_? "warm" : "cold", at.c_str());
+  }
+  if (offFrom >= 0 || solar->spill_.appended_)
+    printf("sim: offline %0.1fh, %u spilled, %u replayed (%u mqtt msgs), %u dropped, %u still pending, %u flash sector erases\n",
+        max(0.0f, min(offTo, hours) - offFrom), solar->spill_.appended_, solar->spill_.replayed_, (uint32_t) mqttSpilled,
+        solar->spill_.dropped_, solar->spill_.pending(), hostFlashErases());
+  for (uint32_t i = 0; i < channels; i++)
+    if (solar->ch_[i].psu_)
+      printf("sim: %s %s\n", solar->ch_[i].psu_->getType().c_str(), solar->ch_[i].psu_->getStats().c_str());
+  for (const auto &s : stateSecs)
+    printf("sim: %-12s %6.1f%% of the time\n", s.first.c_str(), 100 * s.second / (hours * 3600));
+  for (auto uri : gets) {
+    solar->server_.hostRequest(HTTP_GET, uri); //warms any caches
+    uint64_t allocs = hostAllocs();
+    auto resp = solar->server_.hostRequest(HTTP_GET, uri);
+    allocs = hostAllocs() - allocs;
+    printf("sim: GET %s -> %d %s, %u bytes, %u allocs in the handler and shim\n", uri.c_str(), resp.code,
+        resp.type.c_str(), resp.body.length(), (unsigned) allocs);
+    if (resp.type == "application/octet-stream") {
+      int n = decodeHistory(std::string(resp.body.c_str(), resp.body.length()), 0, 5);
+      printf("sim: %d samples decoded, the first 5 above\n", n);
+    } else printf("%s\n", resp.body.c_str());
+    if (resp.header("ETag").length()) { //a poller that already has it
+      allocs = hostAllocs();
+      auto start = std::chrono::steady_clock::now();
+      auto again = solar->server_.hostRequest(HTTP_GET, uri, {}, {{"If-None-Match", resp.header("ETag")}});
+      double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+      printf("sim: GET %s with If-None-Match %s -> %d, %u bytes, %u allocs, %0.0fus\n", uri.c_str(), resp.header("ETag").c_str(),
+          again.code, again.body.length(), (unsigned)(hostAllocs() - allocs), us);
+    }
+  }
+  if (stream.stream) {
+    const String &d = stream.stream->data;
+    int updates = 0, last = -1;
+    for (int at = d.indexOf("data: "); at >= 0; at = d.indexOf("data: ", at + 1)) { updates++; last = at; }
+    printf("sim: /events sent %d updates in %u bytes, %0.1f/min", updates, d.length(), updates / (hours * 60));
+    if (last >= 0) printf(", the last:\n%s", d.substring(last).c_str());
+    else printf("\n");
+  }
+  if (stalled.stream) {
+    if (stalledDropH >= 0) printf("sim: stalled /events stream dropped %0.0fs into the run\n", stalledDropH * 3600);
+    else printf("sim: stalled /events stream still open at the end\n");
+  }
+  fflush(stdout);
+  _Exit(0); //skip static teardown, the publish task may still be running
+}
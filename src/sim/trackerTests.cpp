@@ -0,0 +1,109 @@
+//tracker checks: feeds perturb and inccond scripted panel readings and checks which
+//way each adjustment steps the current limit. no rig, no clock, just the decisions
+#include "trackerTests.h"
+#include <solar.h>
+#include <trackers.h>
+#include <powerSupplies.h>
+#include "../version.h"
+
+//holds whatever the test sets, the trackers only read it
+class ScriptedPSU : public PowerSupply {
+public:
+  bool begin() override { return true; }
+  bool doUpdate() override { return true; }
+  bool setVoltage(float v) override { limitVolt_ = v; return true; }
+  bool setCurrent(float c) override { limitCurr_ = c; return true; }
+  bool enableOutput(bool e) override { outEn_ = e; return true; }
+};
+
+struct TrackerRig {
+  Solar s;
+  Channel &c;
+  ScriptedPSU *psu;
+  TrackerRig() : s(GIT_VERSION), c(s.ch_[0]) {
+    addLogger(&s.pub_); //setup() would, the psu logs through it
+    c.psu_.reset(psu = new ScriptedPSU());
+    c.setpoint_ = 35;
+    s.trackStep_ = 0.1;
+  }
+  ~TrackerRig() { c.psu_.reset(); } //its destructor logs through s.pub_, which goes first
+  //one reading at the current limit: panel at v delivering i, converter lossless
+  float step(Tracker &t, float v, float i) {
+    c.inVolt_ = v;
+    psu->outVolt_ = 28;
+    psu->outCurr_ = v * i / psu->outVolt_;
+    return psu->limitCurr_ = t.track(s, c);
+  }
+};
+
+static int failures = 0;
+static void expect(bool ok, const char *what, float limit) {
+  printf("tracker test: %s %s (limit now %0.3fA)\n", ok? "ok  " : "FAIL", what, limit);
+  if (!ok) failures++;
+}
+static bool near(float a, float b) { return fabs(a - b) < 0.0005; }
+
+static void perturbTests() {
+  TrackerRig r;
+  PerturbObserve t;
+  r.psu->limitCurr_ = 5;
+  float l = r.step(t, 36, 5);
+  expect(near(l, 5.1), "perturb: first step goes up", l);
+  l = r.step(t, 35.8, 5.1);
+  expect(near(l, 5.2), "perturb: keeps going while power rises", l);
+  l = r.step(t, 35.0, 5.15);
+  expect(near(l, 5.1), "perturb: reverses when power falls", l);
+  l = r.step(t, 35.6, 5.1);
+  expect(near(l, 5.0), "perturb: keeps going down while power rises", l);
+  l = r.step(t, 35.7, 5.0);
+  expect(near(l, 5.1), "perturb: reverses again, dithers around the mpp", l);
+  l = r.step(t, 33.0, 5.8);
+  expect(near(l, 5.0), "perturb: no step up more than 5% under the setpoint, even as power rose", l);
+  l = r.step(t, 33.1, 5.7);
+  expect(near(l, 4.9), "perturb: keeps stepping down while under it", l);
+
+  TrackerRig z;
+  PerturbObserve t2;
+  z.psu->limitCurr_ = 0.05;
+  l = z.step(t2, 20, 0.05);
+  expect(l == 0, "perturb: never a negative limit", l);
+}
+
+static void inccondTests() {
+  TrackerRig r;
+  IncConductance t;
+  r.psu->limitCurr_ = 5;
+  float l = r.step(t, 38, 4);
+  expect(near(l, 5.1), "inccond: unprimed, first step goes up", l);
+  l = r.step(t, 37, 5); //dI/dV -1 vs I/V 0.135: right of the mpp
+  expect(near(l, 5.2), "inccond: right of the mpp, more current", l);
+  l = r.step(t, 36.5, 5.05); //dI/dV -0.1 vs I/V 0.138: left of it
+  expect(near(l, 5.1), "inccond: left of the mpp, less current", l);
+  l = r.step(t, 37.0, 4.95); //dI/dV -0.2 vs I/V 0.134: too steep again
+  expect(near(l, 5.2), "inccond: back right of it, more current", l);
+  l = r.step(t, 36.5, 5.019); //dI/dV -0.138 vs I/V 0.1375: within 5%
+  expect(near(l, 5.15), "inccond: at the mpp, reverses with a half step", l);
+  l = r.step(t, 36.5, 5.019);
+  expect(near(l, 5.05), "inccond: panel didn't move, power held, keeps direction", l);
+  l = r.step(t, 36.51, 5.0);
+  expect(near(l, 5.15), "inccond: panel didn't move but power fell, reverses", l);
+  r.psu->limitCurr_ = 5.05; //the set didn't land (capped), so there's no slope to read
+  l = r.step(t, 37.51, 4.95); //would read as left of the mpp
+  expect(near(l, 5.15), "inccond: limit didn't change, direction unchanged", l);
+  l = r.step(t, 33.0, 5.9); //dI/dV -0.21 vs I/V 0.179: right of it, but under the setpoint
+  expect(near(l, 5.05), "inccond: no step up more than 5% under the setpoint", l);
+
+  TrackerRig z;
+  IncConductance t2;
+  z.c.setpoint_ = 40;
+  z.psu->limitCurr_ = 0.05;
+  l = z.step(t2, 20, 0.05);
+  expect(l == 0, "inccond: never a negative limit", l);
+}
+
+int runTrackerTests() {
+  perturbTests();
+  inccondTests();
+  printf("tracker tests: %d failed\n", failures);
+  return failures;
+}
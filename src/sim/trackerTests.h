@@ -0,0 +1,3 @@
+#pragma once
+
+int runTrackerTests(); //checks the hill climbers' step decisions on scripted readings, returns how many failed